@@ -963,7 +963,12 @@ int main(int argc, char** argv) {
                      
                      if (PlaySoundButton("<< Prev") && replayIndex > 0) replayIndex--;
                      ImGui::SameLine();
-                     ImGui::Text("Move %d / %lu", replayIndex + 1, data.size());
+                     if (client.isReplayLoading()) {
+                         // Still streaming in: show how much has arrived
+                         ImGui::Text("Move %d / %lu (loading %u)", replayIndex + 1, data.size(), client.getReplayTotalFrames());
+                     } else {
+                         ImGui::Text("Move %d / %lu", replayIndex + 1, data.size());
+                     }
                      ImGui::SameLine();
                      if (PlaySoundButton("Next >>") && replayIndex < (int)data.size() - 1) replayIndex++;
                      ImGui::SameLine();
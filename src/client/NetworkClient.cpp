@@ -1,4 +1,5 @@
 #include "NetworkClient.h"
+#include "../common/StateCodec.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -17,6 +18,14 @@ NetworkClient::~NetworkClient() {
 
 bool NetworkClient::connectToServer(const std::string& ip, int port) {
     if (connected) return true;
+    // Reconnecting: the old receive thread has already stopped, reap it
+    if (receiveThread.joinable()) receiveThread.join();
+    if (socketFd >= 0) close(socketFd);
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        protocolVersion = 1;
+        protocolFeatures = 0;
+    }
     
     socketFd = socket(AF_INET, SOCK_STREAM, 0);
     if (socketFd < 0) return false;
@@ -32,6 +41,14 @@ bool NetworkClient::connectToServer(const std::string& ip, int port) {
     connected = true;
     running = true;
     receiveThread = std::thread(&NetworkClient::receiveLoop, this);
+
+    // Ask for the newer protocol; an old server just ignores this and we stay on v1
+    HelloPacket hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.version = PROTOCOL_VERSION;
+    hello.features = FEATURE_STATE_DELTA | FEATURE_COMPACT_EVENTS | FEATURE_BATCH | FEATURE_REQUEST_IDS
+                   | FEATURE_REPLAY_STREAM | FEATURE_PRESENCE_DELTA | FEATURE_TIMER_SYNC;
+    sendPacket(CMD_HELLO, &hello, sizeof(hello));
     return true;
 }
 
@@ -72,6 +89,93 @@ void NetworkClient::receiveLoop() {
     }
 }
 
+void NetworkClient::onGameStateUpdated() {
+    gameState.inGame = true;
+    lastStateUpdate = std::chrono::steady_clock::now();
+
+    // Track opponent
+    if (myUsername == gameState.state.p1Name) lastOpponent = gameState.state.p2Name;
+    else lastOpponent = gameState.state.p1Name;
+
+    if (gameState.state.gameOver) {
+        lastStatusMessage = "Game Over. Winner: " + std::string(gameState.state.winner);
+         // Don't set inGame=false immediately, let player see results
+    }
+}
+
+void NetworkClient::appendPacket(std::vector<char>& out, uint8_t command, const void* body, size_t size, uint16_t requestId) {
+    PacketHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = (uint32_t)size;
+    header.command = command;
+    if (requestId) {
+        header.flags = HEADER_FLAG_REQUEST_ID;
+        header.requestId = requestId;
+    }
+    out.insert(out.end(), (const char*)&header, (const char*)&header + sizeof(header));
+    if (size > 0) out.insert(out.end(), (const char*)body, (const char*)body + size);
+}
+
+void NetworkClient::sendPacket(uint8_t command, const void* body, size_t size) {
+    // Header and body in one write, so packets from different threads can't interleave
+    std::vector<char> frame;
+    appendPacket(frame, command, body, size);
+    send(socketFd, frame.data(), frame.size(), 0);
+}
+
+uint16_t NetworkClient::newRequest(uint8_t command) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    if (++nextRequestId == 0) nextRequestId = 1; // 0 means untagged
+    requestLog[nextRequestId % REQUEST_LOG_SIZE] = command;
+    return nextRequestId;
+}
+
+uint8_t NetworkClient::answeredCommand(const PacketHeader& header) {
+    if (!(protocolFeatures & FEATURE_REQUEST_IDS) || !(header.flags & HEADER_FLAG_REQUEST_ID)) return 0;
+    std::lock_guard<std::mutex> lock(requestMutex);
+    return requestLog[header.requestId % REQUEST_LOG_SIZE];
+}
+
+void NetworkClient::sendRequest(uint8_t command, const void* body, size_t size) {
+    // Tags are harmless before the HELLO answer: a server only reads them once negotiated
+    std::vector<char> frame;
+    appendPacket(frame, command, body, size, newRequest(command));
+    send(socketFd, frame.data(), frame.size(), 0);
+}
+
+void NetworkClient::sendBatch(const std::vector<char>& frames, int count) {
+    if (count > 1 && (protocolFeatures & FEATURE_BATCH)) {
+        std::vector<char> batch;
+        appendPacket(batch, CMD_BATCH, frames.data(), frames.size());
+        send(socketFd, batch.data(), batch.size(), 0);
+    } else {
+        // Older server: the same packets, still in one write
+        send(socketFd, frames.data(), frames.size(), 0);
+    }
+}
+
+void NetworkClient::sendLogin(uint8_t command, const std::string& user, const std::string& pass) {
+    LoginRequest req;
+    memset(&req, 0, sizeof(req));
+    strncpy(req.username, user.c_str(), 32);
+    strncpy(req.password, pass.c_str(), 32);
+
+    // The lobby requests ride along: the server handles them in order, right after
+    // the login, so the whole bootstrap costs one round trip
+    std::vector<char> frames;
+    appendPacket(frames, command, &req, sizeof(req), newRequest(command));
+    appendPacket(frames, CMD_FRIEND_LIST, nullptr, 0, newRequest(CMD_FRIEND_LIST));
+    appendPacket(frames, CMD_GET_HISTORY, nullptr, 0, newRequest(CMD_GET_HISTORY));
+    appendPacket(frames, CMD_LEADERBOARD, nullptr, 0, newRequest(CMD_LEADERBOARD));
+    std::lock_guard<std::mutex> lock(dataMutex);
+    sendBatch(frames, 4);
+}
+
+void NetworkClient::requestResync(uint32_t sessionId) {
+    awaitingKeyframe = true;
+    sendPacket(CMD_STATE_RESYNC, &sessionId, sizeof(sessionId));
+}
+
 void NetworkClient::removeChallenge(size_t index) {
     std::lock_guard<std::mutex> lock(dataMutex);
     if (index < challenges.size()) {
@@ -81,6 +185,21 @@ void NetworkClient::removeChallenge(size_t index) {
 
 
 void NetworkClient::processPacket(const PacketHeader& header, const std::vector<char>& body) {
+    if (header.command == CMD_BATCH) {
+        // Unpack and handle each packet as if it had arrived on its own
+        size_t pos = 0;
+        while (body.size() - pos >= sizeof(PacketHeader)) {
+            PacketHeader sub;
+            memcpy(&sub, body.data() + pos, sizeof(sub));
+            pos += sizeof(sub);
+            if (sub.size > body.size() - pos || sub.command == CMD_BATCH) break;
+            std::vector<char> subBody(body.begin() + pos, body.begin() + pos + sub.size);
+            processPacket(sub, subBody);
+            pos += sub.size;
+        }
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(dataMutex);
     std::string cmdName = "UNKNOWN";
     switch(header.command) {
@@ -90,6 +209,8 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
         case CMD_FAIL: cmdName = "CMD_FAIL"; break;
         case CMD_LIST_USERS: cmdName = "CMD_LIST_USERS"; break;
         case CMD_LIST_USERS_RESP: cmdName = "CMD_LIST_USERS_RESP"; break;
+        case CMD_USER_ONLINE: cmdName = "CMD_USER_ONLINE"; break;
+        case CMD_USER_OFFLINE: cmdName = "CMD_USER_OFFLINE"; break;
         case CMD_LEADERBOARD: cmdName = "CMD_LEADERBOARD"; break;
         case CMD_LEADERBOARD_RESP: cmdName = "CMD_LEADERBOARD_RESP"; break;
         case CMD_CHALLENGE_REQ: cmdName = "CMD_CHALLENGE_REQ"; break;
@@ -98,10 +219,15 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
         case CMD_GAME_MOVE: cmdName = "CMD_GAME_MOVE"; break;
         case CMD_GAME_STATE: cmdName = "CMD_GAME_STATE"; break;
         case CMD_GAME_RESULT: cmdName = "CMD_GAME_RESULT"; break;
+        case CMD_TIMER_SYNC: cmdName = "CMD_TIMER_SYNC"; break;
+        case CMD_STATE_DELTA: cmdName = "CMD_STATE_DELTA"; break;
+        case CMD_STATE_RESYNC: cmdName = "CMD_STATE_RESYNC"; break;
+        case CMD_HELLO: cmdName = "CMD_HELLO"; break;
         case CMD_LIST_REPLAYS: cmdName = "CMD_LIST_REPLAYS"; break;
         case CMD_LIST_REPLAYS_RESP: cmdName = "CMD_LIST_REPLAYS_RESP"; break;
         case CMD_GET_REPLAY: cmdName = "CMD_GET_REPLAY"; break;
         case CMD_REPLAY_DATA: cmdName = "CMD_REPLAY_DATA"; break;
+        case CMD_REPLAY_CHUNK: cmdName = "CMD_REPLAY_CHUNK"; break;
         case CMD_PLAY_AI: cmdName = "CMD_PLAY_AI"; break;
         case CMD_RESIGN: cmdName = "CMD_RESIGN"; break;
         case CMD_QUEUE_JOIN: cmdName = "CMD_QUEUE_JOIN"; break;
@@ -120,10 +246,13 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
     }
     std::cout << "[Client] Received Packet Cmd: " << cmdName << " Size: " << header.size << std::endl;
     
+    // Request this packet answers, when the server tags responses (0 = unknown)
+    uint8_t request = answeredCommand(header);
+    bool loginReply = request == 0 || request == CMD_LOGIN || request == CMD_REGISTER;
+
     if (header.command == CMD_OK || header.command == RES_OK) {
-        // Context dependent... assume login/register ok if we were waiting
-        // Ideally we'd have request IDs, but for now:
-        if (!loggedIn) {
+        // Untagged: assume login/register ok if we were waiting
+        if (!loggedIn && loginReply) {
             loginSuccess = true;
             loggedIn = true; // Conservative guess
         }
@@ -143,7 +272,7 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
             std::cout << "[Client] Login Success! Elo: " << myElo << std::endl;
         }
     } else if (header.command == CMD_FAIL) {
-        if (!loggedIn) loginFailed = true;
+        if (!loggedIn && loginReply) loginFailed = true;
         lastStatusMessage = "Operation Failed";
     } else if (header.command == CMD_LIST_USERS_RESP) {
         std::string s(body.begin(), body.end());
@@ -153,6 +282,20 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
         while (std::getline(ss, u)) {
             if (!u.empty()) onlineUsers.push_back(u);
         }
+    } else if (header.command == CMD_USER_ONLINE || header.command == CMD_USER_OFFLINE) {
+        // Presence delta on top of the snapshot we got at login
+        std::string s(body.begin(), body.end());
+        std::stringstream ss(s);
+        std::string u;
+        while (std::getline(ss, u)) {
+            if (u.empty()) continue;
+            auto it = std::find(onlineUsers.begin(), onlineUsers.end(), u);
+            if (header.command == CMD_USER_ONLINE) {
+                if (it == onlineUsers.end()) onlineUsers.push_back(u);
+            } else if (it != onlineUsers.end()) {
+                onlineUsers.erase(it);
+            }
+        }
     } else if (header.command == CMD_LEADERBOARD_RESP) {
          leaderboardText = std::string(body.begin(), body.end());
     } else if (header.command == CMD_CHALLENGE_REQ) {
@@ -169,19 +312,55 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
         lastStatusMessage = "Challenge Accepted!";
     } else if (header.command == CMD_GAME_STATE) {
         if (body.size() >= sizeof(GameStatePacket)) {
-            gameState.inGame = true;
             gameState.state = *(GameStatePacket*)body.data();
-            lastStateUpdate = std::chrono::steady_clock::now();
-            
-            // Track opponent
-            if (myUsername == gameState.state.p1Name) lastOpponent = gameState.state.p2Name;
-            else lastOpponent = gameState.state.p1Name;
-            
-            if (gameState.state.gameOver) {
-                lastStatusMessage = "Game Over. Winner: " + std::string(gameState.state.winner);
-                 // Don't set inGame=false immediately, let player see results
+            onGameStateUpdated();
+        }
+    } else if (header.command == CMD_STATE_DELTA) {
+        StateCodec::Frame frame;
+        if (!StateCodec::parse(body.data(), body.size(), frame)) return;
+        if (!frame.keyframe) {
+            // A delta only applies on top of the one right before it
+            bool inSequence = !awaitingKeyframe && frame.sessionId == deltaSessionId && frame.sequence == deltaSequence + 1;
+            if (!inSequence) {
+                if (!awaitingKeyframe) requestResync(frame.sessionId);
+                return;
+            }
+        }
+        StreamState next = deltaState;
+        if (!StateCodec::apply(frame, next)) {
+            requestResync(frame.sessionId);
+            return;
+        }
+        awaitingKeyframe = false;
+        deltaSessionId = frame.sessionId;
+        deltaSequence = frame.sequence;
+        deltaState = next;
+        gameState.state = StateCodec::expand(deltaState); // Names and message text rendered here
+        onGameStateUpdated();
+    } else if (header.command == CMD_HELLO) {
+        if (body.size() >= sizeof(HelloPacket)) {
+            HelloPacket* hello = (HelloPacket*)body.data();
+            protocolVersion = hello->version;
+            protocolFeatures = hello->features;
+            // A download cut off by a disconnect picks up where it stopped
+            if (replayStreaming) {
+                replayNextFrame = (uint32_t)currentReplay.size();
+                if (protocolFeatures & FEATURE_REPLAY_STREAM) {
+                    for (int i = 0; i < REPLAY_WINDOW; ++i) requestReplayChunk();
+                } else {
+                    replayStreaming = false;
+                }
             }
         }
+    } else if (header.command == CMD_TIMER_SYNC) {
+        if (body.size() >= sizeof(TimerSyncPacket)) {
+            TimerSyncPacket* sync = (TimerSyncPacket*)body.data();
+            hasTimerSync = true;
+            timerSessionId = sync->sessionId;
+            timerPaused = sync->paused != 0;
+            pausedRemainingMs = sync->remainingMs;
+            turnDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(sync->remainingMs);
+        }
     } else if (header.command == CMD_LIST_REPLAYS_RESP) {
         std::string s(body.begin(), body.end());
         replayList.clear();
@@ -198,7 +377,32 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
             for(int i=0; i<count; ++i) currentReplay.push_back(pkts[i]);
         }
         replayReady = true;
+        replayStreaming = false;
         // lastStatusMessage = "Replay Downloaded!";
+    } else if (header.command == CMD_REPLAY_CHUNK) {
+        if (body.size() < sizeof(ReplayChunkHeader) || !replayStreaming) return;
+        ReplayChunkHeader chunk;
+        memcpy(&chunk, body.data(), sizeof(chunk));
+        if ((body.size() - sizeof(chunk)) / sizeof(GameStatePacket) < chunk.frameCount) return;
+        // Stale answer from before a restart/resume
+        if (chunk.firstFrame != currentReplay.size()) return;
+
+        if (chunk.totalFrames == 0) {
+            replayStreaming = false;
+            lastStatusMessage = "Replay not found";
+            return;
+        }
+        const GameStatePacket* frames = (const GameStatePacket*)(body.data() + sizeof(chunk));
+        currentReplay.insert(currentReplay.end(), frames, frames + chunk.frameCount);
+        replayTotalFrames = chunk.totalFrames;
+        // The viewer opens on the first chunk and picks up later ones as they land
+        if (chunk.firstFrame == 0) replayReady = true;
+
+        if (currentReplay.size() >= replayTotalFrames || chunk.frameCount == 0) {
+            replayStreaming = false;
+        } else if (replayNextFrame < replayTotalFrames) {
+            requestReplayChunk(); // Keep the window full
+        }
     } else if (header.command == CMD_HISTORY_DATA) {
         int count = header.size / sizeof(HistoryEntry);
         history.clear();
@@ -236,55 +440,36 @@ void NetworkClient::processPacket(const PacketHeader& header, const std::vector<
 void NetworkClient::registerUser(const std::string& user, const std::string& pass) {
     std::cout << "[Client] Sending REGISTER for " << user << std::endl;
     myUsername = user;
-    LoginRequest req;
-    strncpy(req.username, user.c_str(), 32);
-    strncpy(req.password, pass.c_str(), 32);
-    
-    PacketHeader header = {(uint32_t)sizeof(req), CMD_REGISTER};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &req, sizeof(req), 0);
+    sendLogin(CMD_REGISTER, user, pass);
 }
 
 void NetworkClient::loginUser(const std::string& user, const std::string& pass) {
     std::cout << "[Client] Sending LOGIN for " << user << std::endl;
     myUsername = user;
-    LoginRequest req;
-    strncpy(req.username, user.c_str(), 32);
-    strncpy(req.password, pass.c_str(), 32);
-    
-    PacketHeader header = {(uint32_t)sizeof(req), CMD_LOGIN};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &req, sizeof(req), 0);
-    
-    // Reset flags
+    // Reset flags before sending: the answer may come back before we return
     loginSuccess = false;
     loginFailed = false;
+    sendLogin(CMD_LOGIN, user, pass);
 }
 
 void NetworkClient::refreshList() {
-    PacketHeader header = {0, CMD_LIST_USERS};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_LIST_USERS, nullptr, 0);
 }
 
 void NetworkClient::getLeaderboard() {
-    PacketHeader header = {0, CMD_LEADERBOARD};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_LEADERBOARD, nullptr, 0);
 }
 
 void NetworkClient::sendChallenge(const std::string& target) {
     ChallengePacket pkt;
     strncpy(pkt.targetUser, target.c_str(), 32);
-    PacketHeader header = {(uint32_t)sizeof(pkt), CMD_CHALLENGE_REQ};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &pkt, sizeof(pkt), 0);
+    sendPacket(CMD_CHALLENGE_REQ, &pkt, sizeof(pkt));
 }
 
 void NetworkClient::acceptChallenge(const std::string& target) {
     ChallengePacket pkt;
     strncpy(pkt.targetUser, target.c_str(), 32);
-    PacketHeader header = {(uint32_t)sizeof(pkt), CMD_CHALLENGE_RESP};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &pkt, sizeof(pkt), 0);
+    sendPacket(CMD_CHALLENGE_RESP, &pkt, sizeof(pkt));
     
     // remove from pending
     std::lock_guard<std::mutex> lock(dataMutex);
@@ -294,14 +479,11 @@ void NetworkClient::acceptChallenge(const std::string& target) {
 
 void NetworkClient::sendMove(MoveType type, ItemType item) {
     MovePayload p = { (uint8_t)type, (uint8_t)item };
-    PacketHeader header = {(uint32_t)sizeof(p), CMD_GAME_MOVE};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &p, sizeof(p), 0);
+    sendPacket(CMD_GAME_MOVE, &p, sizeof(p));
 }
 
 void NetworkClient::sendResign() {
-    PacketHeader header = {0, CMD_RESIGN};
-    send(socketFd, &header, sizeof(header), 0);
+    sendPacket(CMD_RESIGN, nullptr, 0);
 }
 
 // Getters
@@ -332,7 +514,17 @@ std::vector<std::string> NetworkClient::getPendingChallenges() {
 
 ClientGameState NetworkClient::getGameState() {
     std::lock_guard<std::mutex> lock(dataMutex);
-    return gameState;
+    ClientGameState result = gameState;
+    // Once CMD_TIMER_SYNC arrives the server stops resending state to tick the clock; count down here
+    if (hasTimerSync && result.inGame && !result.state.gameOver) {
+        int32_t ms = pausedRemainingMs;
+        if (!timerPaused) {
+            ms = (int32_t)std::chrono::duration_cast<std::chrono::milliseconds>(turnDeadline - std::chrono::steady_clock::now()).count();
+            if (ms < 0) ms = 0;
+        }
+        result.state.turnTimeRemaining = (ms + 999) / 1000;
+    }
+    return result;
 }
 
 std::chrono::steady_clock::time_point NetworkClient::getLastStateUpdateTime() const {
@@ -343,11 +535,11 @@ void NetworkClient::resetGame() {
     std::lock_guard<std::mutex> lock(dataMutex);
     gameState.inGame = false;
     memset(&gameState.state, 0, sizeof(GameStatePacket));
+    hasTimerSync = false;
 }
 
 void NetworkClient::requestReplayList() {
-    PacketHeader header = {0, CMD_LIST_REPLAYS};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_LIST_REPLAYS, nullptr, 0);
 }
 
 std::vector<std::string> NetworkClient::getReplayList() {
@@ -356,9 +548,42 @@ std::vector<std::string> NetworkClient::getReplayList() {
 }
 
 void NetworkClient::requestReplayDownload(const std::string& filename) {
-    PacketHeader header = {(uint32_t)filename.size(), CMD_GET_REPLAY};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, filename.c_str(), filename.size(), 0);
+    std::lock_guard<std::mutex> lock(dataMutex);
+    currentReplay.clear();
+    replayFile = filename;
+    replayTotalFrames = 0;
+    replayNextFrame = 0;
+    replayReady = false;
+
+    if (!(protocolFeatures & FEATURE_REPLAY_STREAM)) {
+        replayStreaming = false;
+        sendRequest(CMD_GET_REPLAY, filename.c_str(), filename.size());
+        return;
+    }
+    replayStreaming = true;
+    for (int i = 0; i < REPLAY_WINDOW; ++i) requestReplayChunk();
+}
+
+void NetworkClient::requestReplayChunk() {
+    ReplayChunkRequest req;
+    req.firstFrame = replayNextFrame;
+    req.frameCount = REPLAY_CHUNK_FRAMES;
+    replayNextFrame += REPLAY_CHUNK_FRAMES;
+
+    std::vector<char> body(sizeof(req) + replayFile.size());
+    memcpy(body.data(), &req, sizeof(req));
+    memcpy(body.data() + sizeof(req), replayFile.data(), replayFile.size());
+    sendRequest(CMD_GET_REPLAY_CHUNK, body.data(), body.size());
+}
+
+bool NetworkClient::isReplayLoading() {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    return replayStreaming;
+}
+
+uint32_t NetworkClient::getReplayTotalFrames() {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    return replayTotalFrames;
 }
 
 bool NetworkClient::hasReplayData() {
@@ -384,23 +609,19 @@ std::string NetworkClient::getRematchTarget() {
 }
 
 void NetworkClient::sendPlayAiRequest() {
-    PacketHeader header = {0, CMD_PLAY_AI};
-    send(socketFd, &header, sizeof(header), 0);
+    sendPacket(CMD_PLAY_AI, nullptr, 0);
 }
 
 void NetworkClient::sendJoinQueue() {
-    PacketHeader header = {0, CMD_QUEUE_JOIN};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_QUEUE_JOIN, nullptr, 0);
 }
 
 void NetworkClient::sendLeaveQueue() {
-    PacketHeader header = {0, CMD_QUEUE_LEAVE};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_QUEUE_LEAVE, nullptr, 0);
 }
 
 void NetworkClient::requestHistory() {
-    PacketHeader header = {0, CMD_GET_HISTORY};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_GET_HISTORY, nullptr, 0);
 }
 
 std::vector<HistoryEntry> NetworkClient::getHistory() {
@@ -409,30 +630,24 @@ std::vector<HistoryEntry> NetworkClient::getHistory() {
 }
 
 void NetworkClient::sendTogglePause() {
-    PacketHeader header = {0, CMD_TOGGLE_PAUSE};
-    send(socketFd, &header, sizeof(header), 0);
+    sendPacket(CMD_TOGGLE_PAUSE, nullptr, 0);
 }
 
 // Friends
 void NetworkClient::requestFriendList() {
-    PacketHeader header = {0, CMD_FRIEND_LIST};
-    send(socketFd, &header, sizeof(header), 0);
+    sendRequest(CMD_FRIEND_LIST, nullptr, 0);
 }
 
 void NetworkClient::sendAddFriend(const std::string& friendName) {
     ChallengePacket pkt;
     strncpy(pkt.targetUser, friendName.c_str(), 32);
-    PacketHeader header = {(uint32_t)sizeof(pkt), CMD_FRIEND_ADD};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &pkt, sizeof(pkt), 0);
+    sendPacket(CMD_FRIEND_ADD, &pkt, sizeof(pkt));
 }
 
 void NetworkClient::sendAcceptFriend(const std::string& friendName) {
     ChallengePacket pkt;
     strncpy(pkt.targetUser, friendName.c_str(), 32);
-    PacketHeader header = {(uint32_t)sizeof(pkt), CMD_FRIEND_ACCEPT};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &pkt, sizeof(pkt), 0);
+    sendPacket(CMD_FRIEND_ACCEPT, &pkt, sizeof(pkt));
     
     // Remove from pending
     std::lock_guard<std::mutex> lock(dataMutex);
@@ -443,9 +658,7 @@ void NetworkClient::sendAcceptFriend(const std::string& friendName) {
 void NetworkClient::sendRemoveFriend(const std::string& friendName) {
     ChallengePacket pkt;
     strncpy(pkt.targetUser, friendName.c_str(), 32);
-    PacketHeader header = {(uint32_t)sizeof(pkt), CMD_FRIEND_REMOVE};
-    send(socketFd, &header, sizeof(header), 0);
-    send(socketFd, &pkt, sizeof(pkt), 0);
+    sendPacket(CMD_FRIEND_REMOVE, &pkt, sizeof(pkt));
 }
 
 std::vector<std::string> NetworkClient::getFriendList() {
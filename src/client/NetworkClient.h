@@ -6,6 +6,7 @@
 #include <atomic>
 #include <chrono>
 #include "../common/Protocol.h"
+#include "../common/StateCodec.h"
 
 namespace Buckshot {
 
@@ -57,6 +58,8 @@ public:
     void requestReplayDownload(const std::string& filename);
     bool hasReplayData();
     std::vector<GameStatePacket> getReplayData(); // Consume replay data
+    bool isReplayLoading();          // More chunks still on the way
+    uint32_t getReplayTotalFrames(); // 0 until the first chunk arrives
     
     void sendPlayAiRequest();
     
@@ -99,6 +102,35 @@ private:
     
     void receiveLoop();
     void processPacket(const PacketHeader& header, const std::vector<char>& body);
+    void onGameStateUpdated(); // Requires dataMutex
+    void requestResync(uint32_t sessionId);
+    static void appendPacket(std::vector<char>& out, uint8_t command, const void* body, size_t size,
+                             uint16_t requestId = 0);
+    void sendPacket(uint8_t command, const void* body, size_t size);
+    // Same, tagged with a fresh request id so the response can be matched to it
+    void sendRequest(uint8_t command, const void* body, size_t size);
+    // Sends already-framed packets in one write, as a CMD_BATCH if the server accepted it
+    void sendBatch(const std::vector<char>& frames, int count); // Requires dataMutex
+    // Login/register pipelined with the lobby requests (friends, history, leaderboard)
+    void sendLogin(uint8_t command, const std::string& user, const std::string& pass);
+    uint16_t newRequest(uint8_t command);
+    uint8_t answeredCommand(const PacketHeader& header); // Requires dataMutex
+
+    // Command sent under each recent request id. Ids wrap, so only the last
+    // REQUEST_LOG_SIZE requests can be told apart, far more than are ever in flight.
+    static constexpr int REQUEST_LOG_SIZE = 256;
+    std::mutex requestMutex;
+    uint16_t nextRequestId = 0;
+    uint8_t requestLog[REQUEST_LOG_SIZE] = {};
+
+    // Negotiated with CMD_HELLO (version 1 until the server answers)
+    uint16_t protocolVersion = 1;
+    uint32_t protocolFeatures = 0;
+    // Delta stream position; a gap triggers CMD_STATE_RESYNC
+    uint32_t deltaSessionId = 0;
+    uint32_t deltaSequence = 0;
+    StreamState deltaState = {}; // Baseline the next delta applies to
+    bool awaitingKeyframe = false;
     
     // Data Guards
     std::mutex dataMutex;
@@ -112,6 +144,14 @@ private:
     std::vector<std::string> friendList; 
     std::vector<std::string> incomingFriendRequests; // Just names
     bool replayReady;
+    // Chunked download (FEATURE_REPLAY_STREAM): REPLAY_WINDOW requests stay in flight,
+    // so at most that many chunks are ever buffered on either side
+    static constexpr int REPLAY_WINDOW = 4;
+    std::string replayFile;
+    bool replayStreaming = false;
+    uint32_t replayTotalFrames = 0;
+    uint32_t replayNextFrame = 0; // First frame not yet requested
+    void requestReplayChunk(); // Requires dataMutex
     
     std::string lastOpponent;
     int32_t myElo = 1000;
@@ -121,6 +161,13 @@ private:
     std::vector<std::string> challenges;
     ClientGameState gameState;
     std::chrono::steady_clock::time_point lastStateUpdate;
+
+    // Local turn clock, set by CMD_TIMER_SYNC and counted down here
+    bool hasTimerSync = false;
+    uint32_t timerSessionId = 0;
+    bool timerPaused = false;
+    int32_t pausedRemainingMs = 0;
+    std::chrono::steady_clock::time_point turnDeadline;
 };
 
 }
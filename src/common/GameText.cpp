@@ -0,0 +1,88 @@
+#include "GameText.h"
+
+namespace Buckshot {
+
+static const std::string& playerName(uint8_t index, const std::string& p1, const std::string& p2) {
+    return index == 2 ? p2 : p1;
+}
+
+static std::string shellName(bool live) {
+    return live ? "LIVE" : "BLANK";
+}
+
+std::string GameText::render(const GameEvent* events, int count, const std::string& p1, const std::string& p2) {
+    std::string text;
+    for (int i = 0; i < count; ++i) text += renderEvent(events[i], p1, p2);
+    return text;
+}
+
+std::string GameText::renderEvent(const GameEvent& ev, const std::string& p1, const std::string& p2) {
+    const std::string& who = playerName(ev.player, p1, p2);
+    switch (ev.code) {
+        case EVT_SHELLS_LOADED:
+            return " Loaded " + std::to_string(ev.arg) + " shells (" + std::to_string(ev.arg2) + " Live, "
+                   + std::to_string(ev.arg - ev.arg2) + " Blank)";
+        case EVT_ITEMS_DISTRIBUTED:
+            return " Items distributed.";
+        case EVT_ITEM_INVALID:
+            return who + " tried to use invalid item!";
+        case EVT_ITEM_USED: {
+            std::string text = who + " used ";
+            switch (ev.arg) {
+                case ITEM_BEER:
+                    text += "BEER. ";
+                    text += ev.arg2 == OUTCOME_NONE ? "But gun was empty!" : "Ejected a " + shellName(ev.arg2 == OUTCOME_LIVE) + " round.";
+                    break;
+                case ITEM_CIGARETTES:
+                    text += "CIGARETTES. ";
+                    text += ev.arg2 == OUTCOME_HEALED ? "+1 HP." : "HP Full!";
+                    break;
+                case ITEM_HANDCUFFS:
+                    text += "HANDCUFFS. Opponent skips next turn.";
+                    break;
+                case ITEM_MAGNIFYING_GLASS:
+                    text += "MAGNIFYING GLASS. ";
+                    if (ev.arg2 != OUTCOME_NONE) text += "Next shell is " + shellName(ev.arg2 == OUTCOME_LIVE) + ".";
+                    break;
+                case ITEM_KNIFE:
+                    text += "KNIFE. Next shot double damage.";
+                    break;
+                case ITEM_INVERTER:
+                    text += "INVERTER. Polarity flipped.";
+                    break;
+                case ITEM_EXPIRED_MEDICINE:
+                    text += "MEDICINE. ";
+                    text += ev.arg2 == OUTCOME_HEALED ? "Healed 2 HP!" : "Lost 1 HP!";
+                    break;
+            }
+            return text;
+        }
+        case EVT_ITEM_LIMIT:
+            return " Max 2 items per turn!";
+        case EVT_SHOT: {
+            std::string target = ev.arg == ev.player ? "THEMSELVES" : playerName(ev.arg, p1, p2);
+            return who + " shot " + target + ". It was " + shellName(ev.arg2 != 0) + ".";
+        }
+        case EVT_EXTRA_TURN:
+            return " Extra turn!";
+        case EVT_HANDCUFF_SKIP:
+            return " Opponent was HANDCUFFED. Turn skipped!";
+        case EVT_DIED:
+            return " " + who + " died!";
+        case EVT_RELOADING:
+            return " (Reloading...)";
+        case EVT_RESIGNED:
+            return who + " RESIGNED. " + playerName(ev.player == 1 ? 2 : 1, p1, p2) + " Wins!";
+        case EVT_AFK_TIMEOUT:
+            return " (AFK TIMEOUT)";
+        case EVT_NEW_ROUND:
+            return "New Round Started!";
+        case EVT_PAUSED:
+            return " (PAUSED)";
+        case EVT_RESUMED:
+            return " (RESUMED)";
+    }
+    return "";
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "Protocol.h"
+
+namespace Buckshot {
+
+// Outcome codes carried in GameEvent::arg2 for EVT_ITEM_USED
+enum ItemOutcome : uint8_t {
+    OUTCOME_NONE = 0,        // Beer/glass on an empty gun, cigarettes at full HP
+    OUTCOME_LIVE = 1,        // Beer ejected / glass saw a live round
+    OUTCOME_BLANK = 2,       // Beer ejected / glass saw a blank
+    OUTCOME_HEALED = 3,      // Cigarettes +1, medicine +2
+    OUTCOME_HURT = 4         // Medicine -1
+};
+
+// Turns game event codes into the narrative text shown to players.
+// The server only calls this for clients that still want text (and for replays).
+class GameText {
+public:
+    static std::string render(const GameEvent* events, int count, const std::string& p1, const std::string& p2);
+    static std::string renderEvent(const GameEvent& ev, const std::string& p1, const std::string& p2);
+};
+
+}
@@ -9,8 +9,14 @@ namespace Buckshot {
 struct PacketHeader {
     uint32_t size; // Body size
     uint8_t command;
+    // Former padding. Only read once FEATURE_REQUEST_IDS is negotiated, since
+    // older clients leave it uninitialized.
+    uint8_t flags;      // HEADER_FLAG_*
+    uint16_t requestId; // Chosen by the client, echoed on the direct responses
 };
 
+constexpr uint8_t HEADER_FLAG_REQUEST_ID = 0x01; // requestId is set
+
 // Command Codes
 enum Command : uint8_t {
     CMD_OK = 0, // Used for success responses
@@ -21,6 +27,8 @@ enum Command : uint8_t {
     
     CMD_LIST_USERS = 5,
     CMD_LIST_USERS_RESP = 6,
+    CMD_USER_ONLINE = 7,  // Newline-separated names that came online (FEATURE_PRESENCE_DELTA)
+    CMD_USER_OFFLINE = 8, // Newline-separated names that went offline (FEATURE_PRESENCE_DELTA)
 
     CMD_LEADERBOARD = 30,
     CMD_LEADERBOARD_RESP = 31,
@@ -32,12 +40,18 @@ enum Command : uint8_t {
     CMD_GAME_MOVE = 21,
     CMD_GAME_STATE = 22, // Update board
     CMD_GAME_RESULT = 23, // Win/Loss/Draw
+    CMD_TIMER_SYNC = 24, // Turn clock moved (TimerSyncPacket, FEATURE_TIMER_SYNC)
+    CMD_STATE_DELTA = 25, // Game state as a StateCodec frame (FEATURE_STATE_DELTA)
+    CMD_STATE_RESYNC = 26, // Client missed a delta: uint32 sessionId, answered with a keyframe
+    CMD_BATCH = 27, // Several complete packets (header + body each) back to back (FEATURE_BATCH)
     
     // Replay
     CMD_LIST_REPLAYS   = 40,
     CMD_LIST_REPLAYS_RESP = 41,
     CMD_GET_REPLAY     = 42,
     CMD_REPLAY_DATA    = 43,
+    CMD_GET_REPLAY_CHUNK = 46, // ReplayChunkRequest + filename (FEATURE_REPLAY_STREAM)
+    CMD_REPLAY_CHUNK   = 47,   // ReplayChunkHeader + frameCount GameStatePackets
 
     // AI
     CMD_PLAY_AI = 45,
@@ -65,9 +79,42 @@ enum Command : uint8_t {
     CMD_FRIEND_ACCEPT  = 94,
     CMD_FRIEND_REMOVE  = 95,
 
-    CMD_ERROR = 99
+    CMD_ERROR = 99,
+
+    // Version negotiation (HelloPacket both ways)
+    CMD_HELLO = 100
+};
+
+// Clients that never send CMD_HELLO are treated as version 1 with no features
+constexpr uint16_t PROTOCOL_VERSION = 3;
+
+// Optional protocol features; the server answers CMD_HELLO with the subset it accepted
+enum ProtocolFeature : uint32_t {
+    FEATURE_STATE_DELTA = 1u << 0, // CMD_STATE_DELTA instead of CMD_GAME_STATE
+    FEATURE_COMPACT_EVENTS = 1u << 1, // v3: player indexes + event codes instead of names/text; required by STATE_DELTA
+    FEATURE_BATCH = 1u << 2, // CMD_BATCH envelopes may be sent in either direction
+    FEATURE_REQUEST_IDS = 1u << 3, // Responses carry the request id of the packet they answer
+    FEATURE_REPLAY_STREAM = 1u << 4, // Replays fetched in chunks (CMD_GET_REPLAY_CHUNK)
+    FEATURE_PRESENCE_DELTA = 1u << 5, // CMD_USER_ONLINE/OFFLINE instead of a fresh CMD_LIST_USERS_RESP
+    FEATURE_TIMER_SYNC = 1u << 6, // CMD_TIMER_SYNC instead of the state resent every second; required by STATE_DELTA
 };
 
+struct HelloPacket {
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t features;
+};
+
+// Largest packet body the server accepts; the peer is dropped past this
+constexpr uint32_t MAX_PACKET_SIZE = 100000;
+
+// Largest CMD_BATCH body the server builds; bigger messages go out on their own.
+// Batches never nest.
+constexpr uint32_t MAX_BATCH_SIZE = 64 * 1024;
+
+// CMD_STATE_DELTA flags (see StateCodec)
+constexpr uint8_t STATE_FLAG_KEYFRAME = 0x01;
+
 struct HistoryEntry {
     char timestamp[32];
     char opponent[32];
@@ -143,6 +190,62 @@ struct GameStatePacket {
     bool isPaused;
 };
 
+// Sent whenever a session's turn deadline moves (new turn, pause, resume).
+// Steady clocks aren't comparable across machines, so the deadline travels as the
+// time left at send; the client turns it into a local deadline and counts down.
+struct TimerSyncPacket {
+    uint32_t sessionId;
+    int32_t remainingMs;
+    uint8_t paused; // Clock frozen at remainingMs
+};
+
+// One step of what happened in a game update. Clients render these to text
+// (see GameText), so the server never formats the narrative for them.
+// Players are indexes: 1 = P1, 2 = P2, 0 = none.
+enum GameEventCode : uint8_t {
+    EVT_NONE = 0,
+    EVT_SHELLS_LOADED,      // arg = total, arg2 = live
+    EVT_ITEMS_DISTRIBUTED,
+    EVT_ITEM_INVALID,       // player
+    EVT_ITEM_USED,          // player, arg = ItemType, arg2 = outcome (see GameText)
+    EVT_ITEM_LIMIT,         // Max 2 items per turn
+    EVT_SHOT,               // player, arg = target player, arg2 = 1 live / 0 blank
+    EVT_EXTRA_TURN,
+    EVT_HANDCUFF_SKIP,
+    EVT_DIED,               // player
+    EVT_RELOADING,
+    EVT_RESIGNED,           // player
+    EVT_AFK_TIMEOUT,
+    EVT_NEW_ROUND,
+    EVT_PAUSED,
+    EVT_RESUMED
+};
+
+struct GameEvent {
+    uint8_t code;
+    uint8_t player;
+    uint8_t arg;
+    uint8_t arg2;
+};
+
+// Replays come down in bounded pieces the client asks for, a few requests ahead.
+// Any range can be asked for again, which is how a broken download resumes.
+struct ReplayChunkRequest {
+    uint32_t firstFrame;
+    uint32_t frameCount; // Clamped to REPLAY_CHUNK_FRAMES
+};
+
+struct ReplayChunkHeader {
+    uint32_t totalFrames; // 0 if the replay does not exist
+    uint32_t firstFrame;
+    uint32_t frameCount;  // Frames that follow; 0 past the end
+};
+
+constexpr uint32_t REPLAY_CHUNK_FRAMES = 32;
+
+// Events kept per update; anything past this is dropped like text past 128 chars
+constexpr int MAX_GAME_EVENTS = 12;
+
 // Response codes
 enum ResponseCode : uint8_t {
     RES_OK = 0,
@@ -0,0 +1,210 @@
+#include "StateCodec.h"
+#include "GameText.h"
+#include <cstring>
+#include <cstddef>
+
+namespace Buckshot {
+
+namespace {
+
+enum FieldKind : uint8_t {
+    FIELD_INT32,
+    FIELD_BOOL,
+    FIELD_BYTES,  // Fixed-size raw bytes
+    FIELD_STRING, // Fixed-size, NUL-padded char array
+    FIELD_EVENTS  // eventCount + events
+};
+
+struct FieldDesc {
+    FieldKind kind;
+    size_t offset;
+    size_t size;
+};
+
+#define STATE_FIELD(kind, member) { kind, offsetof(StreamState, state) + offsetof(GameStatePacket, member), sizeof(GameStatePacket::member) }
+#define STREAM_FIELD(kind, member) { kind, offsetof(StreamState, member), sizeof(StreamState::member) }
+
+// Wire field ids are indexes into this table: only ever append to it
+const FieldDesc FIELDS[] = {
+    STATE_FIELD(FIELD_INT32, p1Hp),
+    STATE_FIELD(FIELD_INT32, p2Hp),
+    STATE_FIELD(FIELD_INT32, shellsRemaining),
+    STATE_FIELD(FIELD_INT32, liveCount),
+    STATE_FIELD(FIELD_INT32, blankCount),
+    STATE_FIELD(FIELD_BYTES, p1Inventory),
+    STATE_FIELD(FIELD_BYTES, p2Inventory),
+    STATE_FIELD(FIELD_BOOL, p1Handcuffed),
+    STATE_FIELD(FIELD_BOOL, p2Handcuffed),
+    STATE_FIELD(FIELD_BOOL, knifeActive),
+    STATE_FIELD(FIELD_STRING, currentTurnUser),
+    STATE_FIELD(FIELD_STRING, p1Name),
+    STATE_FIELD(FIELD_STRING, p2Name),
+    STATE_FIELD(FIELD_INT32, p1Elo),
+    STATE_FIELD(FIELD_INT32, p2Elo),
+    STATE_FIELD(FIELD_STRING, message),
+    STATE_FIELD(FIELD_BOOL, gameOver),
+    STATE_FIELD(FIELD_STRING, winner),
+    STATE_FIELD(FIELD_INT32, turnTimeRemaining),
+    STATE_FIELD(FIELD_INT32, p1EloChange),
+    STATE_FIELD(FIELD_INT32, p2EloChange),
+    STATE_FIELD(FIELD_BOOL, isPaused),
+    STREAM_FIELD(FIELD_BYTES, turnPlayer),
+    STREAM_FIELD(FIELD_BYTES, winnerPlayer),
+    STREAM_FIELD(FIELD_EVENTS, eventCount),
+};
+
+#undef STATE_FIELD
+#undef STREAM_FIELD
+
+const size_t EVENTS_OFFSET = offsetof(StreamState, events);
+
+const size_t FIELD_COUNT = sizeof(FIELDS) / sizeof(FIELDS[0]);
+
+}
+
+void StateCodec::putVarint(std::vector<char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+bool StateCodec::getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p >= end) return false;
+        uint8_t byte = (uint8_t)*p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void StateCodec::encode(uint32_t sessionId, uint32_t sequence, bool keyframe,
+                        const StreamState& prev, const StreamState& next, std::vector<char>& out) {
+    StreamState zero;
+    memset(&zero, 0, sizeof(zero));
+    const char* a = keyframe ? (const char*)&zero : (const char*)&prev;
+    const char* b = (const char*)&next;
+
+    out.push_back((char)(keyframe ? STATE_FLAG_KEYFRAME : 0));
+    putVarint(out, sessionId);
+    putVarint(out, sequence);
+
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        const FieldDesc& f = FIELDS[i];
+        const char* va = a + f.offset;
+        const char* vb = b + f.offset;
+
+        if (f.kind == FIELD_STRING) {
+            // Compare up to the terminator so garbage after it doesn't count as a change
+            size_t la = strnlen(va, f.size);
+            size_t lb = strnlen(vb, f.size);
+            if (la == lb && memcmp(va, vb, lb) == 0) continue;
+            out.push_back((char)i);
+            putVarint(out, lb);
+            out.insert(out.end(), vb, vb + lb);
+            continue;
+        }
+
+        if (f.kind == FIELD_EVENTS) {
+            uint8_t ca = (uint8_t)*va;
+            uint8_t cb = (uint8_t)*vb;
+            const char* ea = a + EVENTS_OFFSET;
+            const char* eb = b + EVENTS_OFFSET;
+            if (ca == cb && memcmp(ea, eb, cb * sizeof(GameEvent)) == 0) continue;
+            out.push_back((char)i);
+            putVarint(out, cb);
+            out.insert(out.end(), eb, eb + cb * sizeof(GameEvent));
+            continue;
+        }
+
+        if (memcmp(va, vb, f.size) == 0) continue;
+        out.push_back((char)i);
+        if (f.kind == FIELD_INT32) {
+            int32_t v;
+            memcpy(&v, vb, sizeof(v));
+            putVarint(out, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31)); // zigzag
+        } else if (f.kind == FIELD_BOOL) {
+            out.push_back(*vb ? 1 : 0);
+        } else {
+            out.insert(out.end(), vb, vb + f.size);
+        }
+    }
+}
+
+bool StateCodec::parse(const char* data, size_t size, Frame& frame) {
+    const char* p = data;
+    const char* end = data + size;
+    if (p >= end) return false;
+    uint8_t flags = (uint8_t)*p++;
+    uint64_t session, seq;
+    if (!getVarint(p, end, session) || !getVarint(p, end, seq)) return false;
+    frame.keyframe = (flags & STATE_FLAG_KEYFRAME) != 0;
+    frame.sessionId = (uint32_t)session;
+    frame.sequence = (uint32_t)seq;
+    frame.fields = p;
+    frame.fieldsSize = (size_t)(end - p);
+    return true;
+}
+
+bool StateCodec::apply(const Frame& frame, StreamState& state) {
+    if (frame.keyframe) memset(&state, 0, sizeof(state));
+    char* base = (char*)&state;
+    const char* p = frame.fields;
+    const char* end = frame.fields + frame.fieldsSize;
+
+    while (p < end) {
+        uint8_t id = (uint8_t)*p++;
+        if (id >= FIELD_COUNT) return false;
+        const FieldDesc& f = FIELDS[id];
+        char* dst = base + f.offset;
+
+        if (f.kind == FIELD_INT32) {
+            uint64_t raw;
+            if (!getVarint(p, end, raw)) return false;
+            uint32_t z = (uint32_t)raw;
+            int32_t v = (int32_t)((z >> 1) ^ (~(z & 1) + 1)); // un-zigzag
+            memcpy(dst, &v, sizeof(v));
+        } else if (f.kind == FIELD_BOOL) {
+            if (p >= end) return false;
+            *dst = *p++ ? 1 : 0;
+        } else if (f.kind == FIELD_BYTES) {
+            if ((size_t)(end - p) < f.size) return false;
+            memcpy(dst, p, f.size);
+            p += f.size;
+        } else if (f.kind == FIELD_EVENTS) {
+            uint64_t count;
+            if (!getVarint(p, end, count) || count > MAX_GAME_EVENTS
+                || (uint64_t)(end - p) < count * sizeof(GameEvent)) return false;
+            *dst = (char)count;
+            memcpy(base + EVENTS_OFFSET, p, (size_t)count * sizeof(GameEvent));
+            p += count * sizeof(GameEvent);
+        } else {
+            uint64_t len;
+            if (!getVarint(p, end, len) || len > f.size || (uint64_t)(end - p) < len) return false;
+            memset(dst, 0, f.size);
+            memcpy(dst, p, (size_t)len);
+            p += len;
+        }
+    }
+    return true;
+}
+
+GameStatePacket StateCodec::expand(const StreamState& stream) {
+    GameStatePacket pkt = stream.state;
+    std::string p1(pkt.p1Name, strnlen(pkt.p1Name, sizeof(pkt.p1Name)));
+    std::string p2(pkt.p2Name, strnlen(pkt.p2Name, sizeof(pkt.p2Name)));
+
+    memset(pkt.currentTurnUser, 0, sizeof(pkt.currentTurnUser));
+    memset(pkt.winner, 0, sizeof(pkt.winner));
+    memset(pkt.message, 0, sizeof(pkt.message));
+    if (stream.turnPlayer) strncpy(pkt.currentTurnUser, (stream.turnPlayer == 2 ? p2 : p1).c_str(), sizeof(pkt.currentTurnUser));
+    if (stream.winnerPlayer) strncpy(pkt.winner, (stream.winnerPlayer == 2 ? p2 : p1).c_str(), sizeof(pkt.winner));
+    std::string text = GameText::render(stream.events, stream.eventCount, p1, p2);
+    strncpy(pkt.message, text.c_str(), sizeof(pkt.message));
+    return pkt;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Protocol.h"
+
+namespace Buckshot {
+
+// What a delta stream carries: the classic packet with its name/text fields left
+// empty (p1Name/p2Name are only ever sent in the keyframe since they never change),
+// plus player indexes and event codes in their place.
+struct StreamState {
+    GameStatePacket state;
+    uint8_t turnPlayer;    // 1 = P1, 2 = P2
+    uint8_t winnerPlayer;  // 0 while the game is running
+    uint8_t eventCount;
+    GameEvent events[MAX_GAME_EVENTS];
+};
+
+// Field-level delta encoding of GameStatePacket, shared by server and client.
+//
+// CMD_STATE_DELTA body:
+//   uint8  flags            STATE_FLAG_KEYFRAME: decode against an all-zero state
+//   varint sessionId
+//   varint sequence         +1 per state update of the session
+//   { uint8 field, value }* only the fields that changed
+//
+// Values: int32 as zigzag varint, bool as one byte, inventories/indexes as raw
+// bytes, names as varint length + bytes (without the NUL padding), events as
+// varint count + 4 bytes each.
+class StateCodec {
+public:
+    // Appends a complete CMD_STATE_DELTA body. A keyframe is a delta from zero.
+    static void encode(uint32_t sessionId, uint32_t sequence, bool keyframe,
+                       const StreamState& prev, const StreamState& next, std::vector<char>& out);
+
+    struct Frame {
+        bool keyframe = false;
+        uint32_t sessionId = 0;
+        uint32_t sequence = 0;
+        const char* fields = nullptr; // Field list, pass to apply()
+        size_t fieldsSize = 0;
+    };
+    // Reads the frame prefix. Returns false if the body is malformed.
+    static bool parse(const char* data, size_t size, Frame& frame);
+    // Applies the frame's fields to state (zero it first for a keyframe).
+    // Returns false and leaves state partially updated if the field list is malformed.
+    static bool apply(const Frame& frame, StreamState& state);
+
+    // Full packet for display/replay: fills the name and text fields from the indexes and events
+    static GameStatePacket expand(const StreamState& stream);
+
+    static void putVarint(std::vector<char>& out, uint64_t value);
+    static bool getVarint(const char*& p, const char* end, uint64_t& value);
+};
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "RingBuffer.h"
+#include "OutboundMessage.h"
+
+namespace Buckshot {
+
+class GameSession;
+
+// Everything the server knows about one client, in one record.
+// Records live in SocketServer's fd-indexed table and are reused when the kernel
+// hands out the same fd again; `generation` tells the incarnations apart.
+struct Connection {
+    // --- I/O (SocketServer) ---
+    std::mutex writeMutex;         // Guards open + the outbound fields
+    bool open = false;
+    uint32_t generation = 0;       // Bumped on every accept of this fd
+    int reactorIndex = -1;         // Reactor the connection is pinned to
+    RingBuffer inBuf;              // Owned by the reactor thread, no lock needed
+    std::deque<OutboundPtr> outQueue; // Messages the kernel has not fully accepted yet
+    size_t outOffset = 0;          // Already-sent prefix of outQueue.front()
+    size_t outBytes = 0;           // Unsent bytes across outQueue
+    bool writeArmed = false;       // EPOLLOUT currently requested
+    bool flushQueued = false;      // Listed in the owning reactor's dirty set
+    bool batchOutput = false;      // FEATURE_BATCH: wrap runs of queued messages in CMD_BATCH
+    size_t outSealed = 0;          // Front entries of outQueue already committed (started or enveloped)
+
+    // --- Session (Server) ---
+    // Owned by the connection's reactor: only its callbacks, and tasks posted to it,
+    // touch these.
+    std::string username;          // Empty until login/register
+    // A CMD_REGISTER is waiting for its commit. Packets that arrive meanwhile are
+    // held, framed, and handled in order once it is answered.
+    bool registering = false;
+    std::vector<std::string> heldPackets;
+    size_t heldBytes = 0;
+
+    // Negotiated with CMD_HELLO; legacy clients stay at version 1 / no features.
+    // features is written by the owner and read by whoever sends to the connection.
+    uint16_t protocolVersion = 1;
+    std::atomic<uint32_t> features{0};
+
+    // Game side, written from whichever thread advances the session: under
+    // sessionMutex. Only SocketServer's own locks may be taken while it is held.
+    std::mutex sessionMutex;
+    std::shared_ptr<GameSession> session;
+    uint32_t keyframeSession = 0;  // Session whose delta stream this client is following
+    bool departing = false;        // Disconnecting: no new session may attach
+
+    // Token bucket for inbound packets
+    double rateTokens = 0;
+    std::chrono::steady_clock::time_point rateRefill;
+
+    struct Stats {
+        std::chrono::steady_clock::time_point connectedAt;
+        uint64_t packetsIn = 0;
+        uint64_t bytesIn = 0;
+        std::atomic<uint64_t> packetsOut{0}; // Any thread may send
+        std::atomic<uint64_t> bytesOut{0};
+
+        void reset(std::chrono::steady_clock::time_point now) {
+            connectedAt = now;
+            packetsIn = bytesIn = 0;
+            packetsOut = 0;
+            bytesOut = 0;
+        }
+    } stats;
+
+    bool isAuthenticated() const { return !username.empty(); }
+};
+
+// Stable reference to a connection that survives fd reuse
+struct ConnectionRef {
+    int fd = -1;
+    uint32_t generation = 0;
+};
+
+}
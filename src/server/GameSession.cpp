@@ -1,13 +1,17 @@
 #include "GameSession.h"
+#include "../common/GameText.h"
 #include <iostream>
 #include <algorithm>
 #include <random>
 #include <cstring>
+#include <atomic>
 
 namespace Buckshot {
 
+static std::atomic<uint32_t> nextSessionId{1};
+
 GameSession::GameSession(const std::string& p1, const std::string& p2, int p1Sock, int p2Sock, int p1EloVal, int p2EloVal)
-    : p1Name(p1), p2Name(p2), p1Socket(p1Sock), p2Socket(p2Sock), p1Elo(p1EloVal), p2Elo(p2EloVal), hp1(5), hp2(5), gameOver(false),
+    : id(nextSessionId++), p1Name(p1), p2Name(p2), p1Socket(p1Sock), p2Socket(p2Sock), p1Elo(p1EloVal), p2Elo(p2EloVal), hp1(5), hp2(5), gameOver(false),
       p1Handcuffed(false), p2Handcuffed(false), knifeActive(false), inverterActive(false), itemsUsedThisTurn(0) {
     
     currentTurn = p1Name; // P1 starts
@@ -24,8 +28,8 @@ GameSession::GameSession(const std::string& p1, const std::string& p2, std::shar
 
 void GameSession::loadShells() {
     shells.clear();
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+    thread_local std::random_device rd;
+    thread_local std::mt19937 gen(rd());
     
     // Random number of shells (2-8)
     std::uniform_int_distribution<> countDist(2, 8);
@@ -49,19 +53,19 @@ void GameSession::loadShells() {
         if (s) totalLive++; else totalBlank++;
     }
     
-    lastMessage += " Loaded " + std::to_string(count) + " shells (" + std::to_string(totalLive) + " Live, " + std::to_string(totalBlank) + " Blank)";
+    addEvent(EVT_SHELLS_LOADED, 0, (uint8_t)count, (uint8_t)totalLive);
     
     distributeItems();
     aiKnownShellState = AI_UNKNOWN; // Reset memory on reload
     
     // Record state immediately so Replay sees the new items/shells BEFORE any move consumes them
-    history.push_back(getState());
+    history.push_back(getStreamState());
 }
 
 void GameSession::distributeItems() {
     // Distribute fixed 3 items, max 8 in inventory (matches UI)
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+    thread_local std::random_device rd;
+    thread_local std::mt19937 gen(rd());
     std::uniform_int_distribution<> itemDist(1, 7); // 1-7 (ItemType enum)
 
     // Ensure vectors are sized to 6
@@ -90,7 +94,7 @@ void GameSession::distributeItems() {
     addItems(p1Items);
     addItems(p2Items);
 
-    lastMessage += " Items distributed.";
+    addEvent(EVT_ITEMS_DISTRIBUTED);
 }
 
 void GameSession::useItem(const std::string& player, ItemType item) {
@@ -99,41 +103,33 @@ void GameSession::useItem(const std::string& player, ItemType item) {
     // Find the item
     auto it = std::find(inventory.begin(), inventory.end(), item);
     if (it == inventory.end()) {
-        lastMessage = player + " tried to use invalid item!";
+        setEvent(EVT_ITEM_INVALID, playerIndex(player));
         return;
     }
     
     // Mark as consumed (ITEM_NONE) instead of erasing to preserve order
     *it = ITEM_NONE; 
     
-    lastMessage = player + " used ";
+    uint8_t outcome = OUTCOME_NONE;
 
     if (item == ITEM_BEER) {
-        lastMessage += "BEER. ";
         if (!shells.empty()) {
             bool shell = shells.front();
             shells.pop_front();
-            lastMessage += "Ejected a " + std::string(shell ? "LIVE" : "BLANK") + " round.";
-        } else {
-            lastMessage += "But gun was empty!";
+            outcome = shell ? OUTCOME_LIVE : OUTCOME_BLANK;
         }
     } else if (item == ITEM_CIGARETTES) {
-        lastMessage += "CIGARETTES. ";
         if (player == p1Name) {
-            if (hp1 < 5) { hp1++; lastMessage += "+1 HP."; }
-            else lastMessage += "HP Full!";
+            if (hp1 < 5) { hp1++; outcome = OUTCOME_HEALED; }
         } else {
-            if (hp2 < 5) { hp2++; lastMessage += "+1 HP."; }
-            else lastMessage += "HP Full!";
+            if (hp2 < 5) { hp2++; outcome = OUTCOME_HEALED; }
         }
     } else if (item == ITEM_HANDCUFFS) {
-        lastMessage += "HANDCUFFS. Opponent skips next turn.";
         if (player == p1Name) p2Handcuffed = true; else p1Handcuffed = true;
     } else if (item == ITEM_MAGNIFYING_GLASS) {
-        lastMessage += "MAGNIFYING GLASS. ";
         if (!shells.empty()) {
             bool next = shells.front();
-            lastMessage += "Next shell is " + std::string(next ? "LIVE" : "BLANK") + ".";
+            outcome = next ? OUTCOME_LIVE : OUTCOME_BLANK;
             
             // AI MEMORY UPDATE
             if (player == p2Name) {
@@ -141,10 +137,8 @@ void GameSession::useItem(const std::string& player, ItemType item) {
             }
         }
     } else if (item == ITEM_KNIFE) {
-        lastMessage += "KNIFE. Next shot double damage.";
         knifeActive = true;
     } else if (item == ITEM_INVERTER) {
-        lastMessage += "INVERTER. Polarity flipped.";
         if (!shells.empty()) {
             shells.front() = !shells.front();
             // If AI knew the state, flip memory too
@@ -153,11 +147,10 @@ void GameSession::useItem(const std::string& player, ItemType item) {
             }
         }
     } else if (item == ITEM_EXPIRED_MEDICINE) {
-        lastMessage += "MEDICINE. ";
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
+        thread_local std::random_device rd;
+        thread_local std::mt19937 gen(rd());
         if (gen() % 2 == 0) {
-            lastMessage += "Healed 2 HP!";
+            outcome = OUTCOME_HEALED;
             if (player == p1Name) {
                 hp1 += 2; 
                 if (hp1 > 5) hp1 = 5;
@@ -166,7 +159,7 @@ void GameSession::useItem(const std::string& player, ItemType item) {
                 if (hp2 > 5) hp2 = 5;
             }
         } else {
-            lastMessage += "Lost 1 HP!";
+            outcome = OUTCOME_HURT;
             if (player == p1Name) hp1--; else hp2--;
             // TODO: Check death here? 
              if (hp1 <= 0 || hp2 <= 0) {
@@ -175,6 +168,8 @@ void GameSession::useItem(const std::string& player, ItemType item) {
             }
         }
     }
+
+    setEvent(EVT_ITEM_USED, playerIndex(player), (uint8_t)item, outcome);
 }
 
 void GameSession::processMove(const std::string& player, MoveType move, ItemType item) {
@@ -186,7 +181,7 @@ void GameSession::processMove(const std::string& player, MoveType move, ItemType
 
     if (move == USE_ITEM) {
         if (itemsUsedThisTurn >= 2) {
-            lastMessage += " Max 2 items per turn!";
+            addEvent(EVT_ITEM_LIMIT);
             return;
         }
         useItem(player, item);
@@ -209,24 +204,22 @@ void GameSession::processMove(const std::string& player, MoveType move, ItemType
     int damage = knifeActive ? 2 : 1;
     knifeActive = false; // Consumed
     
-    std::string shellType = isLive ? "LIVE" : "BLANK";
-    lastMessage = player + " shot ";
     
     bool switchTurn = true;
     bool handcuffsActive = (player == p1Name) ? p2Handcuffed : p1Handcuffed;
 
     if (move == SHOOT_SELF) {
-        lastMessage += "THEMSELVES. It was " + shellType + ".";
+        setEvent(EVT_SHOT, playerIndex(player), playerIndex(player), isLive ? 1 : 0);
         if (isLive) {
             if (player == p1Name) hp1 -= damage; else hp2 -= damage;
         } else {
             // Shoots self with blank -> Extra turn
             switchTurn = false; 
-            lastMessage += " Extra turn!";
+            addEvent(EVT_EXTRA_TURN);
         }
     } else {
         std::string opponent = (player == p1Name) ? p2Name : p1Name;
-        lastMessage += opponent + ". It was " + shellType + ".";
+        setEvent(EVT_SHOT, playerIndex(player), playerIndex(opponent), isLive ? 1 : 0);
         if (isLive) {
             if (player == p1Name) hp2 -= damage; else hp1 -= damage;
         }
@@ -234,7 +227,7 @@ void GameSession::processMove(const std::string& player, MoveType move, ItemType
     
     // Handcuff logic: if turn needs to switch, but opponent is handcuffed, skip them.
     if (switchTurn && handcuffsActive) {
-        lastMessage += " Opponent was HANDCUFFED. Turn skipped!";
+        addEvent(EVT_HANDCUFF_SKIP);
         // Consumed handcuffs
         if (player == p1Name) p2Handcuffed = false; else p1Handcuffed = false;
         switchTurn = false; // Keep turn
@@ -243,11 +236,11 @@ void GameSession::processMove(const std::string& player, MoveType move, ItemType
     if (hp1 <= 0) {
         gameOver = true;
         winner = p2Name;
-        lastMessage += " " + p1Name + " died!";
+        addEvent(EVT_DIED, 1);
     } else if (hp2 <= 0) {
         gameOver = true;
         winner = p1Name;
-        lastMessage += " " + p2Name + " died!";
+        addEvent(EVT_DIED, 2);
     } else if (switchTurn) {
         currentTurn = (currentTurn == p1Name) ? p2Name : p1Name;
     }
@@ -255,11 +248,11 @@ void GameSession::processMove(const std::string& player, MoveType move, ItemType
     // Reload if empty and game not over
     if (shells.empty() && !gameOver) {
         loadShells();
-        lastMessage += " (Reloading...)";
+        addEvent(EVT_RELOADING);
     }
     
     // Record history
-    history.push_back(getState());
+    history.push_back(getStreamState());
 }
 
 void GameSession::resign(const std::string& player) {
@@ -268,30 +261,32 @@ void GameSession::resign(const std::string& player) {
     gameOver = true;
     if (player == p1Name) {
         winner = p2Name;
-        lastMessage = p1Name + " RESIGNED. " + p2Name + " Wins!";
+        setEvent(EVT_RESIGNED, 1);
         hp1 = 0; // Force HP to 0 for visual clarity
     } else {
         winner = p1Name;
-        lastMessage = p2Name + " RESIGNED. " + p1Name + " Wins!";
+        setEvent(EVT_RESIGNED, 2);
         hp2 = 0;
     }
     
-    history.push_back(getState());
+    history.push_back(getStreamState());
 }
 
 bool GameSession::checkTimeout(long long timeoutSeconds) {
     if (gameOver) return false;
     if (paused) return false;
     auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - lastActionTime).count();
+    auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastActionTime).count();
+    auto elapsed = elapsedMs / 1000;
     
     // Bump timeout to 60s minimum effectively if the passed value is small?
     // User complaint "randomly lose" might mean the server loop calls this with a short timer.
     
-    if (elapsed > timeoutSeconds) {
+    // Exact comparison: the server's AFK timer fires right at the deadline
+    if (elapsedMs >= timeoutSeconds * 1000) {
         // Double check: if it's the very first turn, give more time?
         resign(currentTurn); // Current turn player loses
-        lastMessage += " (AFK TIMEOUT)"; 
+        addEvent(EVT_AFK_TIMEOUT);
         std::cout << "Session timeout: " << currentTurn << " AFK for " << elapsed << "s" << std::endl;
         return true;
     }
@@ -304,7 +299,20 @@ void GameSession::setEloChanges(int p1Delta, int p2Delta) {
 }
 
 GameStatePacket GameSession::getState() const {
-    GameStatePacket pkt;
+    return StateCodec::expand(getStreamState());
+}
+
+std::vector<GameStatePacket> GameSession::getHistory() const {
+    std::vector<GameStatePacket> out;
+    out.reserve(history.size());
+    for (const auto& snap : history) out.push_back(StateCodec::expand(snap));
+    return out;
+}
+
+StreamState GameSession::getStreamState() const {
+    StreamState snap;
+    memset(&snap, 0, sizeof(snap));
+    GameStatePacket& pkt = snap.state;
     pkt.p1Hp = hp1;
     pkt.p2Hp = hp2;
     pkt.shellsRemaining = (int)shells.size();
@@ -330,17 +338,15 @@ GameStatePacket GameSession::getState() const {
     pkt.p2Handcuffed = p2Handcuffed;
     pkt.knifeActive = knifeActive;
     
-    strncpy(pkt.currentTurnUser, currentTurn.c_str(), 32);
+    // Names go out once; turn, winner and message are indexes and event codes
     strncpy(pkt.p1Name, p1Name.c_str(), 32);
     strncpy(pkt.p2Name, p2Name.c_str(), 32);
     pkt.p1Elo = p1Elo;
     pkt.p2Elo = p2Elo;
-    strncpy(pkt.message, lastMessage.c_str(), 128);
-    if (gameOver) {
-        strncpy(pkt.winner, winner.c_str(), 32);
-    } else {
-        memset(pkt.winner, 0, 32);
-    }
+    snap.turnPlayer = playerIndex(currentTurn);
+    if (gameOver) snap.winnerPlayer = playerIndex(winner);
+    snap.eventCount = (uint8_t)events.size();
+    std::copy(events.begin(), events.end(), snap.events);
     
     // Time remaining
     if (paused) {
@@ -356,7 +362,17 @@ GameStatePacket GameSession::getState() const {
     pkt.p2EloChange = eloChangeP2;
     pkt.isPaused = paused;
 
-    return pkt;
+    return snap;
+}
+
+void GameSession::setEvent(uint8_t code, uint8_t player, uint8_t arg, uint8_t arg2) {
+    events.clear();
+    addEvent(code, player, arg, arg2);
+}
+
+void GameSession::addEvent(uint8_t code, uint8_t player, uint8_t arg, uint8_t arg2) {
+    if (events.size() >= MAX_GAME_EVENTS) return;
+    events.push_back(GameEvent{code, player, arg, arg2});
 }
 
 bool GameSession::executeAiTurn() {
@@ -376,7 +392,7 @@ bool GameSession::executeAiTurn() {
     auto now = std::chrono::steady_clock::now();
     long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastActionTime).count();
     
-    if (elapsed < 2000) return false; // Wait 2 seconds before acting
+    if (elapsed < AI_THINK_DELAY_MS) return false; // Wait 2 seconds before acting
     
     // DECISION LOGIC
     
@@ -463,6 +479,24 @@ bool GameSession::executeAiTurn() {
     return true;
 }
 
+int32_t GameSession::getTurnRemainingMs() const {
+    if (paused) return pausedTimeRemaining * 1000;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(getTurnDeadline() - std::chrono::steady_clock::now()).count();
+    return ms > 0 ? (int32_t)ms : 0;
+}
+
+std::chrono::steady_clock::time_point GameSession::getTurnDeadline() const {
+    return lastActionTime + std::chrono::seconds(TURN_TIME_SECONDS);
+}
+
+bool GameSession::isAiTurnPending() const {
+    return isAiGame() && !gameOver && !paused && currentTurn == p2Name;
+}
+
+std::chrono::steady_clock::time_point GameSession::getAiActionTime() const {
+    return lastActionTime + std::chrono::milliseconds(AI_THINK_DELAY_MS);
+}
+
 std::string GameSession::getCurrentTurnUser() const {
     return currentTurn;
 }
@@ -478,7 +512,7 @@ void GameSession::startRound() {
     p1Items.clear();
     p2Items.clear();
     itemsUsedThisTurn = 0;
-    lastMessage = "New Round Started!";
+    setEvent(EVT_NEW_ROUND);
     lastActionTime = std::chrono::steady_clock::now(); // Reset timer
     loadShells();
 }
@@ -493,7 +527,7 @@ void GameSession::togglePause() {
         pausedTimeRemaining = (int32_t)(30 - elapsed);
         if (pausedTimeRemaining < 0) pausedTimeRemaining = 0;
         
-        lastMessage += " (PAUSED)";
+        addEvent(EVT_PAUSED);
     } else {
         // Resume: Shift lastActionTime so that (now - lastActionTime) equals the resumed duration
         // We want: 30 - (now - new_lastActionTime) = pausedTimeRemaining
@@ -502,7 +536,7 @@ void GameSession::togglePause() {
         
         lastActionTime = now - std::chrono::seconds(30 - pausedTimeRemaining);
 
-        lastMessage += " (RESUMED)";
+        addEvent(EVT_RESUMED);
     }
 }
 
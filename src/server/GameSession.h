@@ -3,12 +3,17 @@
 #include <deque>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include "../common/Protocol.h"
+#include "../common/StateCodec.h"
 
 namespace Buckshot {
 
 class GameSession {
 public:
+    static constexpr int TURN_TIME_SECONDS = 30;   // AFK limit per turn
+    static constexpr int AI_THINK_DELAY_MS = 2000; // Dealer waits this long before acting
+
     GameSession(const std::string& p1, const std::string& p2, int p1Sock, int p2Sock, int p1EloVal, int p2EloVal);
     
     // Core Logic
@@ -19,31 +24,45 @@ public:
     void setEloChanges(int p1Delta, int p2Delta);
     
     // Getters
-    GameStatePacket getState() const;
+    GameStatePacket getState() const;  // Full text form (legacy clients)
+    StreamState getStreamState() const; // Indexes + event codes (delta streams)
     bool isGameOver() const;
     std::string getCurrentTurnUser() const;
     int getP1Socket() const { return p1Socket; }
     int getP2Socket() const { return p2Socket; }
     std::string getP1Name() const { return p1Name; }
     std::string getP2Name() const { return p2Name; }
-    std::vector<GameStatePacket> getHistory() const { return history; }
+    std::vector<GameStatePacket> getHistory() const;
+    const std::vector<StreamState>& getStreamHistory() const { return history; } // Unexpanded
+    uint32_t getId() const { return id; }
     
     // AI
     bool isAiGame() const { return p2Socket == -1; }
     bool executeAiTurn();
+
+    // Scheduling: the server arms one-shot timers for these instead of polling
+    std::chrono::steady_clock::time_point getTurnDeadline() const; // AFK timeout
+    bool isAiTurnPending() const;
+    std::chrono::steady_clock::time_point getAiActionTime() const;
+    int32_t getTurnRemainingMs() const; // Frozen value while paused
     
     // Pause
     void togglePause();
     bool isPaused() const { return paused; }
 
+    // Held by the server while it reads or advances this game. Sessions are
+    // independent, so games on different reactors run in parallel.
+    std::mutex mutex;
+
 private:
+    uint32_t id;
     std::string p1Name, p2Name;
     int p1Socket;
     int p2Socket;
     int p1Elo; // Stored current Elo
     int p2Elo; // Stored current Elo
     
-    std::vector<GameStatePacket> history; 
+    std::vector<StreamState> history; 
     std::chrono::steady_clock::time_point lastActionTime; 
     int itemsUsedThisTurn = 0;
     int eloChangeP1 = 0;
@@ -54,7 +73,7 @@ private:
     int totalLive;
     int totalBlank;
     std::string currentTurn;
-    std::string lastMessage;
+    std::vector<GameEvent> events; // What happened in the last action, rendered by GameText
     bool gameOver;
     std::string winner;
     
@@ -71,6 +90,9 @@ private:
     void loadShells();
     void distributeItems();
     void useItem(const std::string& player, ItemType item);
+    void setEvent(uint8_t code, uint8_t player = 0, uint8_t arg = 0, uint8_t arg2 = 0); // Replaces the events
+    void addEvent(uint8_t code, uint8_t player = 0, uint8_t arg = 0, uint8_t arg2 = 0);
+    uint8_t playerIndex(const std::string& name) const { return name == p2Name ? 2 : 1; }
     
     // AI Memory
     enum AiShellState { AI_UNKNOWN, AI_KNOWN_LIVE, AI_KNOWN_BLANK };
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+namespace Buckshot {
+
+// Unbounded lock-free multi-producer / single-consumer queue (Vyukov's intrusive
+// node queue). push() is one atomic exchange from any thread; pop() belongs to the
+// single consumer. A push that another thread is halfway through can make pop()
+// report empty for a moment, so producers must signal the consumer *after* push()
+// returns (SocketServer::post writes the reactor's eventfd).
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head(&stub), tail(&stub) {}
+    ~MpscQueue() {
+        T discard;
+        while (pop(discard)) {}
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node(std::move(value));
+        link(node);
+    }
+
+    bool pop(T& out) {
+        Node* first = tail;
+        Node* next = first->next.load(std::memory_order_acquire);
+        if (first == &stub) {
+            if (!next) return false;
+            tail = next;
+            first = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            out = std::move(first->value);
+            delete first;
+            return true;
+        }
+        // `first` is the last node. Unless a push is in flight, put the stub
+        // behind it so it can be handed out without leaving the queue headless.
+        if (first != head.load(std::memory_order_acquire)) return false;
+        link(&stub);
+        next = first->next.load(std::memory_order_acquire);
+        if (!next) return false;
+        tail = next;
+        out = std::move(first->value);
+        delete first;
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+        Node() = default;
+        explicit Node(T v) : value(std::move(v)) {}
+    };
+
+    void link(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    Node stub;
+    std::atomic<Node*> head; // Producers swap themselves in here
+    Node* tail;              // Consumer only
+};
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+#include "../common/Protocol.h"
+
+namespace Buckshot {
+
+// A packet (header + body) encoded once into a single immutable buffer.
+// Queue the same pointer on any number of connections; the bytes are freed when
+// the last connection has written them out.
+// A message can instead stand for a region of an open file, which the socket layer
+// hands to sendfile() so the bytes never pass through userspace.
+class OutboundMessage {
+public:
+    // A non-zero requestId marks the message as the response to that request
+    static std::shared_ptr<const OutboundMessage> make(uint8_t command, const void* body, size_t size,
+                                                       uint16_t requestId = 0) {
+        return prefix(command, body, size, 0, requestId);
+    }
+
+    // Header plus the start of the body; the remaining `trailing` body bytes must be
+    // queued right behind it (e.g. a file region)
+    static std::shared_ptr<const OutboundMessage> prefix(uint8_t command, const void* body, size_t size,
+                                                         size_t trailing, uint16_t requestId = 0) {
+        auto msg = std::make_shared<OutboundMessage>();
+        msg->bytes.resize(sizeof(PacketHeader) + size);
+        msg->trailing = trailing;
+        PacketHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.size = (uint32_t)(size + trailing);
+        header.command = command;
+        if (requestId) {
+            header.flags |= HEADER_FLAG_REQUEST_ID;
+            header.requestId = requestId;
+        }
+        std::memcpy(msg->bytes.data(), &header, sizeof(header));
+        if (size > 0) std::memcpy(msg->bytes.data() + sizeof(header), body, size);
+        return msg;
+    }
+
+    // Already-framed bytes, sent as-is
+    static std::shared_ptr<const OutboundMessage> raw(const void* data, size_t size) {
+        auto msg = std::make_shared<OutboundMessage>();
+        msg->bytes.assign((const char*)data, (const char*)data + size);
+        return msg;
+    }
+
+    // `owner` keeps fd open until every connection has sent the region
+    static std::shared_ptr<const OutboundMessage> file(std::shared_ptr<const void> owner, int fd,
+                                                       off_t offset, size_t length) {
+        auto msg = std::make_shared<OutboundMessage>();
+        msg->fileOwner = std::move(owner);
+        msg->fileFd = fd;
+        msg->fileOffset = offset;
+        msg->fileLength = length;
+        return msg;
+    }
+
+    const char* data() const { return bytes.data(); }
+    size_t size() const { return isFile() ? fileLength : bytes.size(); }
+
+    size_t trailingSize() const { return trailing; } // Bytes of this packet in later messages
+    bool isFile() const { return fileFd >= 0; }
+    int fd() const { return fileFd; }
+    off_t offset() const { return fileOffset; }
+
+private:
+    std::vector<char> bytes;
+    size_t trailing = 0;
+    std::shared_ptr<const void> fileOwner;
+    int fileFd = -1;
+    off_t fileOffset = 0;
+    size_t fileLength = 0;
+};
+
+using OutboundPtr = std::shared_ptr<const OutboundMessage>;
+
+}
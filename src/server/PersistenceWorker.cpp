@@ -0,0 +1,59 @@
+#include "PersistenceWorker.h"
+#include "ReplayManager.h"
+
+namespace Buckshot {
+
+PersistenceWorker::PersistenceWorker(UserManager& users, RecordedCallback onRecorded)
+    : users(users), onRecorded(std::move(onRecorded)) {
+    thread = std::thread([this]() { run(); });
+}
+
+PersistenceWorker::~PersistenceWorker() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueReady.notify_one();
+    if (thread.joinable()) thread.join();
+}
+
+void PersistenceWorker::submit(MatchResult result) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(result));
+    }
+    queueReady.notify_one();
+}
+
+void PersistenceWorker::run() {
+    while (true) {
+        MatchResult result;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) return; // Stopping, and everything is written
+            result = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        MatchRecorded done = persist(result);
+        if (onRecorded) onRecorded(done);
+    }
+}
+
+PersistenceWorker::MatchRecorded PersistenceWorker::persist(const MatchResult& result) {
+    std::vector<GameStatePacket> frames;
+    frames.reserve(result.history.size());
+    for (const auto& snap : result.history) frames.push_back(StateCodec::expand(snap));
+
+    std::string replay = ReplayManager::saveReplay(result.p1, result.p2, result.winner, frames);
+    auto deltas = users.recordMatch(result.winner, result.loser, replay);
+
+    MatchRecorded done;
+    done.sessionId = result.sessionId;
+    done.winnerDelta = deltas.first;
+    done.loserDelta = deltas.second;
+    return done;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../common/StateCodec.h"
+#include "UserManager.h"
+
+namespace Buckshot {
+
+// Writes finished games to disk off the reactor threads.
+// The reactor submits a MatchResult and moves on; the worker thread saves the replay,
+// records the match in the database, and reports a MatchRecorded with the Elo deltas.
+class PersistenceWorker {
+public:
+    struct MatchResult {
+        uint32_t sessionId = 0;
+        std::string p1, p2;
+        std::string winner, loser;
+        std::vector<StreamState> history; // Expanded to full packets on the worker
+    };
+    struct MatchRecorded {
+        uint32_t sessionId = 0;
+        int winnerDelta = 0;
+        int loserDelta = 0;
+    };
+
+    // onRecorded runs on the worker thread: post the result to the owner's loop from it
+    using RecordedCallback = std::function<void(const MatchRecorded&)>;
+
+    PersistenceWorker(UserManager& users, RecordedCallback onRecorded);
+    ~PersistenceWorker(); // Finishes every queued result before returning
+
+    void submit(MatchResult result);
+
+private:
+    UserManager& users;
+    RecordedCallback onRecorded;
+    std::thread thread;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<MatchResult> queue;
+    bool stopping = false;
+
+    void run();
+    MatchRecorded persist(const MatchResult& result);
+};
+
+}
@@ -5,6 +5,10 @@
 #include <filesystem>
 #include <ctime>
 #include <iomanip>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace Buckshot {
 
@@ -62,22 +66,35 @@ std::string ReplayManager::getReplayList(const std::string& userFilter) {
     return ss.str();
 }
 
-std::vector<GameStatePacket> ReplayManager::loadReplay(const std::string& filename) {
-    std::vector<GameStatePacket> history;
-    std::string path = REPLAY_DIR + "/" + filename;
-    
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) return history;
-    
+bool ReplayManager::isValidName(const std::string& filename) {
+    if (filename.empty() || filename.find('/') != std::string::npos || filename.find('\\') != std::string::npos) return false;
+    if (filename.find("..") != std::string::npos || filename.find('\0') != std::string::npos) return false;
+    return std::filesystem::path(filename).extension() == ".replay";
+}
+
+ReplayFile::~ReplayFile() {
+    if (fd >= 0) close(fd);
+}
+
+off_t ReplayFile::frameOffset(uint32_t frame) {
+    // Files start with a size_t frame count
+    return (off_t)sizeof(size_t) + (off_t)frame * (off_t)sizeof(GameStatePacket);
+}
+
+std::shared_ptr<ReplayFile> ReplayManager::openReplay(const std::string& filename) {
+    if (!isValidName(filename)) return nullptr;
+    auto replay = std::make_shared<ReplayFile>();
+    replay->fd = open((REPLAY_DIR + "/" + filename).c_str(), O_RDONLY | O_CLOEXEC);
+    if (replay->fd < 0) return nullptr;
+
+    struct stat st;
     size_t count = 0;
-    file.read((char*)&count, sizeof(count));
-    
-    if (count > 0) {
-        history.resize(count);
-        file.read((char*)history.data(), count * sizeof(GameStatePacket));
-    }
-    
-    return history;
+    if (fstat(replay->fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || pread(replay->fd, &count, sizeof(count), 0) != (ssize_t)sizeof(count)) return nullptr;
+    // Only promise frames that are really there, or sendfile would come up short
+    size_t stored = (size_t)(st.st_size - (off_t)sizeof(count)) / sizeof(GameStatePacket);
+    replay->totalFrames = (uint32_t)std::min(count, stored);
+    return replay;
 }
 
 }
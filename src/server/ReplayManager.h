@@ -3,15 +3,29 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <sys/types.h>
 #include "../common/Protocol.h"
 
 namespace Buckshot {
 
+// An open replay whose header has been checked, for serving frames with sendfile()
+struct ReplayFile {
+    int fd = -1;
+    uint32_t totalFrames = 0;
+
+    ~ReplayFile();
+    static off_t frameOffset(uint32_t frame); // File position of a frame
+};
+
 class ReplayManager {
 public:
     static std::string saveReplay(const std::string& p1, const std::string& p2, const std::string& winner, const std::vector<GameStatePacket>& history);
     static std::string getReplayList(const std::string& userFilter = "");
-    static std::vector<GameStatePacket> loadReplay(const std::string& filename);
+    // nullptr if the name is invalid or the file is missing/unreadable
+    static std::shared_ptr<ReplayFile> openReplay(const std::string& filename);
+    // Names come from clients: only plain "*.replay" files inside the replay directory
+    static bool isValidName(const std::string& filename);
 };
 
 }
@@ -0,0 +1,84 @@
+#include "RingBuffer.h"
+#include <cstring>
+#include <algorithm>
+
+namespace Buckshot {
+
+static size_t roundUpPow2(size_t v) {
+    size_t p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+RingBuffer::RingBuffer(size_t initialCapacity, size_t maxCapacity)
+    : initialCap(roundUpPow2(initialCapacity)), maxCap(roundUpPow2(std::max(initialCapacity, maxCapacity))) {
+}
+
+void RingBuffer::reallocate(size_t newCap) {
+    // Copies the readable bytes to the front of a fresh block (head = 0)
+    std::unique_ptr<char[]> fresh(new char[newCap]);
+    if (used > 0) peek(fresh.get(), used);
+    data = std::move(fresh);
+    cap = newCap;
+    head = 0;
+}
+
+size_t RingBuffer::writableSpan(char*& ptr) {
+    if (cap == 0) reallocate(initialCap);
+    if (used == cap) {
+        if (cap >= maxCap) return 0;
+        reallocate(cap * 2);
+    }
+    size_t tail = (head + used) & (cap - 1);
+    ptr = data.get() + tail;
+    // Either up to the end of storage, or up to head if the free space wraps
+    return (tail >= head) ? cap - tail : head - tail;
+}
+
+void RingBuffer::commit(size_t n) {
+    used += n;
+}
+
+bool RingBuffer::peek(void* dst, size_t n) const {
+    if (n > used) return false;
+    size_t first = std::min(n, cap - head);
+    memcpy(dst, data.get() + head, first);
+    if (n > first) memcpy((char*)dst + first, data.get(), n - first);
+    return true;
+}
+
+const char* RingBuffer::contiguous(size_t n) {
+    if (n > used) return nullptr;
+    if (head + n > cap) {
+        // Frame wraps around: straighten the ring once, readers then see it linear
+        reallocate(cap);
+    }
+    return data.get() + head;
+}
+
+void RingBuffer::consume(size_t n) {
+    if (n >= used) {
+        head = 0;
+        used = 0;
+        return;
+    }
+    head = (head + n) & (cap - 1);
+    used -= n;
+}
+
+void RingBuffer::shrinkIfIdle() {
+    if (used == 0 && cap > initialCap) {
+        data.reset();
+        cap = 0;
+        head = 0;
+    }
+}
+
+void RingBuffer::reset() {
+    data.reset();
+    cap = 0;
+    head = 0;
+    used = 0;
+}
+
+}
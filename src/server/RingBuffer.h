@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+namespace Buckshot {
+
+// Byte ring used as a connection's receive buffer.
+// Capacity is a power of two that starts small, doubles on demand up to a hard cap,
+// and can be shrunk back once the connection goes idle. Consumers parse frames in
+// place: contiguous() only moves bytes when a frame happens to straddle the wrap point.
+class RingBuffer {
+public:
+    RingBuffer(size_t initialCapacity = 4096, size_t maxCapacity = 128 * 1024);
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+    size_t capacity() const { return cap; }
+    size_t maxCapacity() const { return maxCap; }
+
+    // Free contiguous region at the tail, growing the buffer if it is full.
+    // Returns 0 when the buffer is full and already at its cap.
+    size_t writableSpan(char*& ptr);
+    void commit(size_t n);
+
+    // Copy the first n readable bytes out without consuming them
+    bool peek(void* dst, size_t n) const;
+    // Pointer to the first n readable bytes as one contiguous block
+    const char* contiguous(size_t n);
+    void consume(size_t n);
+
+    // Give back storage grown for a burst once nothing is buffered;
+    // the next read re-allocates at the initial capacity
+    void shrinkIfIdle();
+    void reset();
+
+private:
+    std::unique_ptr<char[]> data;
+    size_t initialCap;
+    size_t maxCap;
+    size_t cap = 0;
+    size_t head = 0; // Read index
+    size_t used = 0;
+
+    void reallocate(size_t newCap);
+};
+
+}
@@ -5,20 +5,25 @@
 #include <cstring>
 #include "../common/Protocol.h"
 #include "ReplayManager.h"
+#include "../common/StateCodec.h"
 
 namespace Buckshot {
 
-Server::Server(int port) 
-    : port(port), running(false), socketServer(port)
+thread_local Server::ReplyContext Server::replyTo;
+
+Server::Server(int port, int reactorCount, int workerCount, const DatabaseOptions& dbOptions)
+    : port(port), running(false), socketServer(port, reactorCount), userManager(dbOptions),
+      persistence(userManager, [this](const PersistenceWorker::MatchRecorded& recorded) {
+          socketServer.post([this, recorded]() { onResultRecorded(recorded); });
+      }),
+      workers(workerCount, [this](WorkerPool::Task done) { socketServer.post(std::move(done)); })
 {
-    lastTimeoutCheck = std::chrono::steady_clock::now();
-    lastMatchmakingBatch = std::chrono::steady_clock::now();
-    lastStateBroadcast = std::chrono::steady_clock::now();
-    
     // Bind Callbacks
     socketServer.setConnectCallback(std::bind(&Server::onConnect, this, std::placeholders::_1));
-    socketServer.setDataCallback(std::bind(&Server::onData, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    socketServer.setDataCallback(std::bind(&Server::onData, this, std::placeholders::_1, std::placeholders::_2));
     socketServer.setDisconnectCallback(std::bind(&Server::onDisconnect, this, std::placeholders::_1));
+
+    registerHandlers();
 }
 
 void Server::run() {
@@ -27,167 +32,457 @@ void Server::run() {
     socketServer.run(); 
 }
 
-void Server::sendPacket(int client, const void* data, size_t size) {
-    socketServer.sendData(client, data, size);
+void Server::sendPacket(int client, const OutboundPtr& msg) {
+    if (Connection* conn = socketServer.getConnection(client)) {
+        conn->stats.packetsOut++;
+        conn->stats.bytesOut += msg->size();
+    }
+    socketServer.sendMessage(client, msg);
+}
+
+void Server::sendPacket(int client, uint8_t command, const void* body, size_t size) {
+    uint16_t requestId = client == replyTo.client ? replyTo.requestId : 0;
+    sendPacket(client, OutboundMessage::make(command, body, size, requestId));
+}
+
+void Server::replyAsync(int client, uint8_t command, std::function<std::string()> work) {
+    DeferredReply deferred = deferReply(client);
+    auto body = std::make_shared<std::string>();
+    workers.submit([body, work]() { *body = work(); },
+                   [this, deferred, command, body]() {
+        completeReply(deferred, [&](int client, Connection&) {
+            sendPacket(client, command, body->data(), body->size());
+        });
+    });
+}
+
+Server::DeferredReply Server::deferReply(int client) {
+    DeferredReply deferred;
+    Connection* conn = socketServer.getConnection(client);
+    deferred.ref = ConnectionRef{client, conn ? conn->generation : 0};
+    deferred.requestId = client == replyTo.client ? replyTo.requestId : 0;
+    return deferred;
+}
+
+void Server::completeReply(const DeferredReply& deferred, const std::function<void(int client, Connection& conn)>& reply) {
+    Connection* conn = socketServer.getConnection(deferred.ref);
+    if (!conn) return;
+    ReplyContext outer = replyTo;
+    replyTo.client = deferred.ref.fd;
+    replyTo.requestId = deferred.requestId;
+    reply(deferred.ref.fd, *conn);
+    replyTo = outer;
 }
 
 void Server::onConnect(int clientFd) {
+    Connection* conn = socketServer.getConnection(clientFd);
+    if (conn) {
+        // The record may be a reused slot; start the session half fresh
+        conn->username.clear();
+        conn->registering = false;
+        conn->heldPackets.clear();
+        conn->heldBytes = 0;
+        conn->protocolVersion = 1;
+        conn->features = 0;
+        conn->rateTokens = RATE_BURST;
+        conn->rateRefill = std::chrono::steady_clock::now();
+        conn->stats.reset(conn->rateRefill);
+        {
+            std::lock_guard<std::mutex> lock(conn->sessionMutex);
+            conn->session.reset();
+            conn->keyframeSession = 0;
+            conn->departing = false;
+        }
+    }
     std::cout << "New connection: " << clientFd << std::endl;
-    clientBuffers[clientFd] = std::vector<char>(); // Init buffer
 }
 
 void Server::onDisconnect(int clientFd) {
-    auto game = getGameSession(clientFd);
+    Connection* conn = socketServer.getConnection(clientFd);
+    if (!conn) return;
+    std::shared_ptr<GameSession> game;
+    {
+        // From here on no game can pick this connection up
+        std::lock_guard<std::mutex> lock(conn->sessionMutex);
+        conn->departing = true;
+        game = conn->session;
+    }
     if (game) {
-        std::string user = authenticatedUsers[clientFd];
-        if (!user.empty()) {
-            std::cout << "Player " << user << " disconnected." << std::endl;
-            game->resign(user);
+        std::lock_guard<std::mutex> lock(game->mutex);
+        // A finished game waiting on its result just lets go of this connection below
+        if (!game->isGameOver()) {
+            std::string user = conn->username;
+            if (!user.empty()) {
+                std::cout << "Player " << user << " disconnected." << std::endl;
+                game->resign(user);
+            }
+            // Close the session out so its timers stop and the opponent sees the result
+            if (game->isGameOver()) {
+                sendGameState(game);
+                finishGame(game);
+            }
         }
     }
     
-    if (authenticatedUsers.count(clientFd)) {
-        std::string u = authenticatedUsers[clientFd];
-        pendingChallenges.erase(u);
-        for (auto it = pendingChallenges.begin(); it != pendingChallenges.end(); ) {
-            if (it->second == u) it = pendingChallenges.erase(it);
-            else ++it;
+    if (conn->isAuthenticated()) {
+        const std::string& u = conn->username;
+        {
+            std::lock_guard<std::mutex> lock(challengesMutex);
+            pendingChallenges.erase(u);
+            for (auto it = pendingChallenges.begin(); it != pendingChallenges.end(); ) {
+                if (it->second == u) it = pendingChallenges.erase(it);
+                else ++it;
+            }
         }
+        std::lock_guard<std::mutex> lock(queueMutex);
         auto qIt = std::find(matchmakingQueue.begin(), matchmakingQueue.end(), u);
         if (qIt != matchmakingQueue.end()) matchmakingQueue.erase(qIt);
     }
     
-    authenticatedUsers.erase(clientFd);
-    clientBuffers.erase(clientFd);
-    
-    broadcastUserList();
+    unbindUser(clientFd, *conn);
+    std::lock_guard<std::mutex> lock(conn->sessionMutex);
+    conn->session.reset();
 }
 
-void Server::onData(int clientFd, const char* data, size_t size) {
-    // Append to buffer
-    std::vector<char>& buf = clientBuffers[clientFd];
-    buf.insert(buf.end(), data, data + size);
-    
-    // Process packets loop
+void Server::onData(int clientFd, RingBuffer& in) {
+    Connection* conn = socketServer.getConnection(clientFd);
+    if (!conn) return;
+
+    // Refill the token bucket for the time since the last read
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - conn->rateRefill).count();
+    conn->rateTokens = std::min(RATE_BURST, conn->rateTokens + elapsed * RATE_PER_SECOND);
+    conn->rateRefill = now;
+
+    // Process packets loop (frames are read in place, consumed as we go)
     while (true) {
-        if (buf.size() < sizeof(PacketHeader)) break;
-        
         // Peek header
-        PacketHeader* header = (PacketHeader*)buf.data();
-        size_t totalSize = sizeof(PacketHeader) + header->size;
-        
-        if (buf.size() < totalSize) break; // Wait for more data
-        
+        PacketHeader header;
+        if (!in.peek(&header, sizeof(header))) break;
+
         // Sanity Check
-        if (header->size > 100000) {
-             std::cout << "Oversized packet (" << header->size << "), disconnecting " << clientFd << std::endl;
+        if (header.size > MAX_PACKET_SIZE) {
+             std::cout << "Oversized packet (" << header.size << "), disconnecting " << clientFd << std::endl;
              socketServer.closeSocket(clientFd);
              return;
         }
-        
-        // Extract body
-        std::vector<char> body;
-        if (header->size > 0) {
-            body.assign(buf.begin() + sizeof(PacketHeader), buf.begin() + totalSize);
+
+        size_t totalSize = sizeof(PacketHeader) + header.size;
+        if (in.size() < totalSize) break; // Wait for more data
+
+        if (conn->rateTokens < 1.0) {
+             std::cout << "Packet flood, disconnecting " << clientFd << std::endl;
+             socketServer.closeSocket(clientFd);
+             return;
         }
-        
+        conn->rateTokens -= 1.0;
+        conn->stats.packetsIn++;
+        conn->stats.bytesIn += totalSize;
+
+        // The handler reads the body straight out of the receive buffer
+        const char* frame = in.contiguous(totalSize);
+        PacketView body{frame + sizeof(PacketHeader), header.size};
+
         // Process
-        processPacket(clientFd, *header, body);
-        
+        processPacket(clientFd, *conn, header, body);
+
         // Remove from buffer
-        buf.erase(buf.begin(), buf.begin() + totalSize);
+        in.consume(totalSize);
     }
 }
 
 void Server::startGameloop() {
-    // Uses SocketServer timer instead of Asio timer
-    socketServer.addTimer(100, [this]() {
-        // 1. Timeout Checks
-        auto now = std::chrono::steady_clock::now();
-        if (std::chrono::duration_cast<std::chrono::seconds>(now - lastTimeoutCheck).count() >= 1) {
-            lastTimeoutCheck = now;
-            for (auto it = activeGames.begin(); it != activeGames.end();) {
-                auto& game = *it;
-                if (game->checkTimeout(30)) {
-                        std::cout << "Game timed out!" << std::endl;
-                        
-                        // Calculate Elo & Record Match BEFORE sending state
-                        std::string winner = game->getState().winner;
-                        std::string lose = (winner == game->getP1Name()) ? game->getP2Name() : game->getP1Name();
-                        std::string replay = ReplayManager::saveReplay(game->getP1Name(), game->getP2Name(), winner, game->getHistory());
-                        auto deltas = userManager.recordMatch(winner, lose, replay);
-                        game->setEloChanges((winner==game->getP1Name())?deltas.first : deltas.second, (winner==game->getP2Name())?deltas.first : deltas.second);
-
-                        // Send FINAL state (Game Over + Elo)
-                        GameStatePacket state = game->getState();
-                        PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                        sendPacket(game->getP1Socket(), &h, sizeof(h));
-                        sendPacket(game->getP1Socket(), &state, sizeof(state));
-                        sendPacket(game->getP2Socket(), &h, sizeof(h));
-                        sendPacket(game->getP2Socket(), &state, sizeof(state));
-                        
-                        it = activeGames.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+    // Sessions arm their own deadlines (see armSessionTimers); only matchmaking is periodic
+    socketServer.addTimer(5000, [this]() { processMatchmaking(); });
+    socketServer.addTimer(60000, [this]() { dumpCommandMetrics(); });
+}
+
+// Fixed-size name fields arrive straight from the wire and need not be NUL-terminated
+template <size_t N>
+static std::string fixedString(const char (&field)[N]) {
+    return std::string(field, strnlen(field, N));
+}
+
+static int msUntil(std::chrono::steady_clock::time_point when) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(when - std::chrono::steady_clock::now()).count();
+    return ms > 0 ? (int)ms : 0;
+}
+
+void Server::armSessionTimers(const std::shared_ptr<GameSession>& game) {
+    SessionTimers* entry;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        entry = &sessionTimers[game.get()];
+    }
+    SessionTimers& timers = *entry;
+    socketServer.removeTimer(timers.afk);
+    socketServer.removeTimer(timers.ai);
+    timers.afk = timers.ai = INVALID_TIMER;
+
+    if (game->isGameOver()) {
+        socketServer.removeTimer(timers.clock);
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        sessionTimers.erase(game.get());
+        return;
+    }
+
+    std::weak_ptr<GameSession> weak = game;
+    if (!game->isPaused()) {
+        timers.afk = socketServer.addOneShotTimer(msUntil(game->getTurnDeadline()), [this, weak]() {
+            auto g = weak.lock();
+            if (!g) return;
+            std::lock_guard<std::mutex> lock(g->mutex);
+            if (!g->isGameOver()) onSessionTimeout(g); // May have ended while this fired
+        });
+    }
+    if (game->isAiTurnPending()) {
+        timers.ai = socketServer.addOneShotTimer(msUntil(game->getAiActionTime()), [this, weak]() {
+            auto g = weak.lock();
+            if (!g) return;
+            std::lock_guard<std::mutex> lock(g->mutex);
+            if (!g->isGameOver()) onSessionAiTurn(g);
+        });
+    }
+    if (timers.clock == INVALID_TIMER && !clockSynced(game)) {
+        timers.clock = socketServer.addTimer(1000, [this, weak]() {
+            auto g = weak.lock();
+            if (!g) return;
+            std::lock_guard<std::mutex> lock(g->mutex);
+            if (!g->isGameOver()) sendClockState(g);
+        });
+    }
+
+    // FEATURE_TIMER_SYNC clients count down locally; they only hear about the clock when it moves
+    auto deadline = game->getTurnDeadline();
+    if (!timers.synced || deadline != timers.syncedDeadline || game->isPaused() != timers.syncedPaused) {
+        timers.synced = true;
+        timers.syncedDeadline = deadline;
+        timers.syncedPaused = game->isPaused();
+        sendTimerSync(game);
+    }
+}
+
+void Server::sendTimerSync(const std::shared_ptr<GameSession>& game) {
+    TimerSyncPacket sync;
+    memset(&sync, 0, sizeof(sync));
+    sync.sessionId = game->getId();
+    sync.remainingMs = game->getTurnRemainingMs();
+    sync.paused = game->isPaused() ? 1 : 0;
+    OutboundPtr msg = OutboundMessage::make(CMD_TIMER_SYNC, &sync, sizeof(sync));
+    for (int sock : {game->getP1Socket(), game->getP2Socket()}) {
+        Connection* conn = socketServer.getConnection(sock);
+        if (conn && (conn->features & FEATURE_TIMER_SYNC)) sendPacket(sock, msg);
+    }
+}
+
+bool Server::clockSynced(const std::shared_ptr<GameSession>& game) {
+    for (int sock : {game->getP1Socket(), game->getP2Socket()}) {
+        Connection* conn = socketServer.getConnection(sock);
+        if (conn && !(conn->features & FEATURE_TIMER_SYNC)) return false;
+    }
+    return true;
+}
+
+void Server::sendClockState(const std::shared_ptr<GameSession>& game) {
+    // Outside the state stream: these players never get deltas, so no baseline moves
+    OutboundPtr msg;
+    for (int sock : {game->getP1Socket(), game->getP2Socket()}) {
+        Connection* conn = socketServer.getConnection(sock);
+        if (!conn || (conn->features & FEATURE_TIMER_SYNC)) continue;
+        {
+            std::lock_guard<std::mutex> lock(conn->sessionMutex);
+            if (conn->session != game) continue;
+        }
+        if (!msg) {
+            GameStatePacket state = StateCodec::expand(game->getStreamState());
+            msg = OutboundMessage::make(CMD_GAME_STATE, &state, sizeof(state));
         }
+        sendPacket(sock, msg);
+    }
+}
 
-        // 1.5 PERIODIC BROADCAST (Sync Timers)
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastStateBroadcast).count() >= 1000) {
-            lastStateBroadcast = now;
-            for (auto& game : activeGames) {
-                    if (!game->isGameOver()) {
-                        GameStatePacket state = game->getState();
-                        PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                        sendPacket(game->getP1Socket(), &h, sizeof(h));
-                        sendPacket(game->getP1Socket(), &state, sizeof(state));
-                        sendPacket(game->getP2Socket(), &h, sizeof(h));
-                        sendPacket(game->getP2Socket(), &state, sizeof(state));
-                    }
-            }
+bool Server::startSession(const std::shared_ptr<GameSession>& game, const ConnectionRef& p1, const ConnectionRef& p2) {
+    std::lock_guard<std::mutex> gameLock(game->mutex);
+    Connection* c1 = socketServer.getConnection(p1.fd);
+    Connection* c2 = p2.fd >= 0 ? socketServer.getConnection(p2.fd) : nullptr; // None for the Dealer
+    if (!c1 || c1 == c2 || (p2.fd >= 0 && !c2)) return false;
+
+    {
+        // Both players are claimed at once, so two games can never share one of them.
+        // The refs are checked under the claim: a player who left (or whose fd now
+        // belongs to someone else) cannot be attached afterwards.
+        std::unique_lock<std::mutex> l1(c1->sessionMutex, std::defer_lock);
+        std::unique_lock<std::mutex> l2;
+        if (c2) {
+            l2 = std::unique_lock<std::mutex>(c2->sessionMutex, std::defer_lock);
+            std::lock(l1, l2);
+        } else {
+            l1.lock();
         }
-        
-        // 2. AI Logic
-        for (auto it = activeGames.begin(); it != activeGames.end();) {
-            auto& game = *it;
-            if (game->isAiGame() && game->executeAiTurn()) {
-                    if (game->isGameOver()) {
-                        std::string winner = game->getState().winner;
-                        std::string lose = (winner == game->getP1Name()) ? game->getP2Name() : game->getP1Name();
-                        std::string replay = ReplayManager::saveReplay(game->getP1Name(), game->getP2Name(), winner, game->getHistory());
-                        auto deltas = userManager.recordMatch(winner, lose, replay);
-                        game->setEloChanges((winner==game->getP1Name())?deltas.first : deltas.second, (winner==game->getP2Name())?deltas.first : deltas.second);
-                    }
-
-                    GameStatePacket state = game->getState();
-                    PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                    sendPacket(game->getP1Socket(), &h, sizeof(h));
-                    sendPacket(game->getP1Socket(), &state, sizeof(state));
-                    
-                    if (game->isGameOver()) {
-                        it = activeGames.erase(it);
-                        continue;
-                    }
+        auto claimable = [this](Connection* conn, const ConnectionRef& ref) {
+            return !conn->session && !conn->departing && socketServer.getConnection(ref);
+        };
+        if (!claimable(c1, p1) || (c2 && !claimable(c2, p2))) return false;
+        c1->session = game;
+        if (c2) c2->session = game;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        activeGames.insert(game);
+    }
+    sendGameState(game);
+    armSessionTimers(game);
+    return true;
+}
+
+void Server::endSession(const std::shared_ptr<GameSession>& game) {
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = sessionTimers.find(game.get());
+        if (it != sessionTimers.end()) {
+            socketServer.removeTimer(it->second.afk);
+            socketServer.removeTimer(it->second.ai);
+            socketServer.removeTimer(it->second.clock);
+            sessionTimers.erase(it);
+        }
+        stateStreams.erase(game.get());
+        activeGames.erase(game);
+    }
+    for (int sock : {game->getP1Socket(), game->getP2Socket()}) {
+        Connection* conn = socketServer.getConnection(sock);
+        if (!conn) continue;
+        std::lock_guard<std::mutex> lock(conn->sessionMutex);
+        if (conn->session == game) conn->session.reset();
+    }
+}
+
+std::shared_ptr<GameSession> Server::sessionOf(Connection& conn) {
+    std::lock_guard<std::mutex> lock(conn.sessionMutex);
+    return conn.session;
+}
+
+bool Server::inSession(int sock) {
+    Connection* conn = socketServer.getConnection(sock);
+    return conn && sessionOf(*conn);
+}
+
+void Server::finishGame(const std::shared_ptr<GameSession>& game) {
+    armSessionTimers(game); // Game over: drops the session's timers
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        if (!savingResults.emplace(game->getId(), game).second) return; // Already submitted
+    }
+
+    // The session stays attached to its players until the result is written;
+    // inSession() keeps both of them out of new games on a stale rating until then
+    bool p2Won = game->getStreamState().winnerPlayer == 2;
+    PersistenceWorker::MatchResult result;
+    result.sessionId = game->getId();
+    result.p1 = game->getP1Name();
+    result.p2 = game->getP2Name();
+    result.winner = p2Won ? result.p2 : result.p1;
+    result.loser = p2Won ? result.p1 : result.p2;
+    result.history = game->getStreamHistory();
+    persistence.submit(std::move(result));
+}
+
+void Server::onResultRecorded(const PersistenceWorker::MatchRecorded& recorded) {
+    std::shared_ptr<GameSession> game;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = savingResults.find(recorded.sessionId);
+        if (it == savingResults.end()) return;
+        game = it->second;
+        savingResults.erase(it);
+    }
+    std::lock_guard<std::mutex> lock(game->mutex);
+
+    bool p2Won = game->getStreamState().winnerPlayer == 2;
+    game->setEloChanges(p2Won ? recorded.loserDelta : recorded.winnerDelta,
+                        p2Won ? recorded.winnerDelta : recorded.loserDelta);
+    sendGameState(game); // Only the Elo fields changed
+    endSession(game);
+}
+
+void Server::sendGameState(const std::shared_ptr<GameSession>& game) {
+    StreamState snap = game->getStreamState();
+    StateStream* entry;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        entry = &stateStreams[game.get()];
+    }
+    StateStream& stream = *entry;
+    bool hasBaseline = stream.sequence > 0;
+    stream.sequence++;
+
+    // Each encoding is built at most once, on first use
+    OutboundPtr legacy, delta, keyframe;
+    for (int sock : {game->getP1Socket(), game->getP2Socket()}) {
+        Connection* conn = socketServer.getConnection(sock);
+        if (!conn) continue;
+        bool deltas = (conn->features & FEATURE_STATE_DELTA) != 0;
+        bool following;
+        {
+            std::lock_guard<std::mutex> lock(conn->sessionMutex);
+            // A player who left may have had their fd reused while the result was saved
+            if (conn->session != game) continue;
+            following = hasBaseline && conn->keyframeSession == game->getId();
+            if (deltas) conn->keyframeSession = game->getId();
+        }
+        if (!deltas) {
+            if (!legacy) {
+                GameStatePacket state = StateCodec::expand(snap);
+                legacy = OutboundMessage::make(CMD_GAME_STATE, &state, sizeof(state));
             }
-            ++it;
+            sendPacket(sock, legacy);
+        } else if (following) {
+            if (!delta) delta = encodeState(game->getId(), stream.sequence, false, stream.last, snap);
+            sendPacket(sock, delta);
+        } else {
+            if (!keyframe) keyframe = encodeState(game->getId(), stream.sequence, true, stream.last, snap);
+            sendPacket(sock, keyframe);
         }
-        
-        // 3. Matchmaking
-        processMatchmaking();
-    });
+    }
+    stream.last = snap;
 }
 
-void Server::processMatchmaking() {
-    auto now = std::chrono::steady_clock::now();
-    if (std::chrono::duration_cast<std::chrono::seconds>(now - lastMatchmakingBatch).count() < 5) {
-        return; 
+OutboundPtr Server::encodeState(uint32_t sessionId, uint32_t sequence, bool keyframe,
+                                const StreamState& prev, const StreamState& next) {
+    std::vector<char> body;
+    StateCodec::encode(sessionId, sequence, keyframe, prev, next, body);
+    return OutboundMessage::make(CMD_STATE_DELTA, body.data(), body.size());
+}
+
+void Server::onSessionTimeout(const std::shared_ptr<GameSession>& game) {
+    if (game->checkTimeout(GameSession::TURN_TIME_SECONDS)) {
+        std::cout << "Game timed out!" << std::endl;
+
+        // Send FINAL state now; the Elo changes follow once the result is saved
+        sendGameState(game);
+        finishGame(game);
+    } else {
+        // Deadline moved (new action or pause) since this timer was armed
+        armSessionTimers(game);
     }
-    
+}
+
+void Server::onSessionAiTurn(const std::shared_ptr<GameSession>& game) {
+    if (!game->executeAiTurn()) {
+        armSessionTimers(game);
+        return;
+    }
+
+    sendGameState(game);
+
+    if (game->isGameOver()) finishGame(game);
+    else armSessionTimers(game);
+}
+
+void Server::processMatchmaking() {
+    std::lock_guard<std::mutex> lock(queueMutex);
     if (matchmakingQueue.size() < 2) return;
     
-    lastMatchmakingBatch = now;
-    
     struct QueueEntry {
         std::string username;
         int elo;
@@ -196,7 +491,7 @@ void Server::processMatchmaking() {
     
     for (const auto& uname : matchmakingQueue) {
         int sock = getSocketByUsername(uname);
-        if (sock != -1) {
+        if (sock != -1 && !inSession(sock)) { // Joined a game since queueing: leaves the queue
             auto u = userManager.getUser(uname);
             if (u) {
                 pool.push_back({uname, u->elo});
@@ -214,25 +509,19 @@ void Server::processMatchmaking() {
         QueueEntry p1 = pool.back(); pool.pop_back();
         QueueEntry p2 = pool.back(); pool.pop_back();
         
-        int s1 = getSocketByUsername(p1.username);
-        int s2 = getSocketByUsername(p2.username);
-
-        if (s1 != -1 && s2 != -1) {
-            std::cout << "Matchmaking (Batch): " << p1.username << " (" << p1.elo << ") vs " << p2.username << " (" << p2.elo << ")" << std::endl;
-            auto game = std::make_shared<GameSession>(p1.username, p2.username, s1, s2, p1.elo, p2.elo);
-            activeGames.push_back(game);
-            
-            GameStatePacket state = game->getState();
-            PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-            
-            sendPacket(s1, &h, sizeof(h));
-            sendPacket(s1, &state, sizeof(state));
-            sendPacket(s2, &h, sizeof(h));
-            sendPacket(s2, &state, sizeof(state));
-        } else {
-            if (s1 != -1) matchmakingQueue.push_back(p1.username);
-            if (s2 != -1) matchmakingQueue.push_back(p2.username);
+        ConnectionRef r1 = getUserRef(p1.username);
+        ConnectionRef r2 = getUserRef(p2.username);
+
+        if (r1.fd != -1 && r2.fd != -1) {
+            auto game = std::make_shared<GameSession>(p1.username, p2.username, r1.fd, r2.fd, p1.elo, p2.elo);
+            if (startSession(game, r1, r2)) {
+                std::cout << "Matchmaking (Batch): " << p1.username << " (" << p1.elo << ") vs " << p2.username << " (" << p2.elo << ")" << std::endl;
+                continue;
+            }
         }
+        // Whoever is still free waits for the next round
+        if (r1.fd != -1) matchmakingQueue.push_back(p1.username);
+        if (r2.fd != -1) matchmakingQueue.push_back(p2.username);
     }
     
     for (const auto& entry : pool) {
@@ -241,281 +530,561 @@ void Server::processMatchmaking() {
 }
 
 int Server::getSocketByUsername(const std::string& username) {
-    for (auto& pair : authenticatedUsers) {
-        if (pair.second == username) return pair.first;
-    }
-    return -1;
+    return getUserRef(username).fd;
+}
+
+ConnectionRef Server::getUserRef(const std::string& username) {
+    std::lock_guard<std::mutex> lock(usersMutex);
+    auto it = socketByUser.find(username);
+    if (it == socketByUser.end()) return ConnectionRef();
+    // The ref is only trusted while it still names the connection that logged in
+    return socketServer.getConnection(it->second) ? it->second : ConnectionRef();
 }
 
 std::shared_ptr<GameSession> Server::getGameSession(int client) {
-    for (auto& game : activeGames) {
-        if (game->getP1Socket() == client || game->getP2Socket() == client) return game;
-    }
-    return nullptr;
-}
-
-void Server::processPacket(int client, PacketHeader& header, const std::vector<char>& body) {
-    if (header.command == CMD_REGISTER) {
-        if (header.size == sizeof(LoginRequest)) {
-            LoginRequest* req = (LoginRequest*)body.data();
-            bool success = userManager.registerUser(req->username, req->password);
-            
-            if (success) {
-                // Fetch stats to send
-                auto user = userManager.getUser(req->username);
-                UserStats stats = { user->elo, user->wins, user->losses };
-                PacketHeader resp = {(uint32_t)sizeof(stats), CMD_LOGIN_SUCCESS};
-                sendPacket(client, &resp, sizeof(resp));
-                sendPacket(client, &stats, sizeof(stats));
-
-                authenticatedUsers[client] = req->username;
-                std::cout << "Registered: " << req->username << std::endl;
-            } else {
-                 PacketHeader resp = {0, CMD_FAIL};
-                 sendPacket(client, &resp, sizeof(resp));
-            }
+    Connection* conn = socketServer.getConnection(client);
+    return conn ? sessionOf(*conn) : nullptr;
+}
+
+void Server::bindUser(int client, Connection& conn, const std::string& username) {
+    // A re-login on a new socket takes over the name
+    unbindUser(client, conn);
+    conn.username = username;
+    std::lock_guard<std::mutex> lock(usersMutex);
+    socketByUser[username] = ConnectionRef{client, conn.generation};
+    userManager.setOnline(username, true);
+    queuePresence(username, true);
+}
+
+void Server::unbindUser(int client, Connection& conn) {
+    if (!conn.isAuthenticated()) return;
+    {
+        std::lock_guard<std::mutex> lock(usersMutex);
+        auto it = socketByUser.find(conn.username);
+        if (it != socketByUser.end() && it->second.fd == client && it->second.generation == conn.generation) {
+            socketByUser.erase(it);
+            userManager.setOnline(conn.username, false);
+            queuePresence(conn.username, false);
         }
-    } else if (header.command == CMD_LOGIN) {
-        if (header.size == sizeof(LoginRequest)) {
-            LoginRequest* req = (LoginRequest*)body.data();
-            bool success = userManager.loginUser(req->username, req->password);
-            if (success) {
-                // Fetch stats
-                auto user = userManager.getUser(req->username);
-                UserStats stats = { user->elo, user->wins, user->losses };
-                PacketHeader resp = {(uint32_t)sizeof(stats), CMD_LOGIN_SUCCESS};
-                sendPacket(client, &resp, sizeof(resp));
-                sendPacket(client, &stats, sizeof(stats));
-
-                authenticatedUsers[client] = req->username;
-                broadcastUserList();
-                std::cout << "Logged in: " << req->username << std::endl;
-            } else {
-                PacketHeader resp = {0, CMD_FAIL};
-                sendPacket(client, &resp, sizeof(resp));
-            }
+    }
+    conn.username.clear();
+}
+
+void Server::registerHandlers() {
+    auto reg = [this](Command cmd, const char* name, Handler handler, uint32_t minSize, uint32_t maxSize, bool requiresAuth) {
+        CommandEntry& e = commandTable[cmd];
+        e.handler = handler;
+        e.name = name;
+        e.minSize = minSize;
+        e.maxSize = maxSize;
+        e.requiresAuth = requiresAuth;
+    };
+    const uint32_t login = sizeof(LoginRequest);
+    const uint32_t target = sizeof(ChallengePacket);
+    reg(CMD_REGISTER,       "REGISTER",       &Server::handleRegister,       login, login, false);
+    reg(CMD_LOGIN,          "LOGIN",          &Server::handleLogin,          login, login, false);
+    reg(CMD_LIST_USERS,     "LIST_USERS",     &Server::handleListUsers,      0, 0, false);
+    reg(CMD_LEADERBOARD,    "LEADERBOARD",    &Server::handleLeaderboard,    0, 0, false);
+    reg(CMD_CHALLENGE_REQ,  "CHALLENGE_REQ",  &Server::handleChallengeReq,   target, target, true);
+    reg(CMD_CHALLENGE_RESP, "CHALLENGE_RESP", &Server::handleChallengeResp,  target, target, true);
+    reg(CMD_PLAY_AI,        "PLAY_AI",        &Server::handlePlayAi,         0, 0, true);
+    reg(CMD_LIST_REPLAYS,   "LIST_REPLAYS",   &Server::handleListReplays,    0, 0, true);
+    reg(CMD_GET_REPLAY,     "GET_REPLAY",     &Server::handleGetReplay,      1, 255, false);
+    reg(CMD_GET_REPLAY_CHUNK, "GET_REPLAY_CHUNK", &Server::handleGetReplayChunk, sizeof(ReplayChunkRequest) + 1, sizeof(ReplayChunkRequest) + 255, false);
+    reg(CMD_GET_HISTORY,    "GET_HISTORY",    &Server::handleGetHistory,     0, 0, true);
+    reg(CMD_RESIGN,         "RESIGN",         &Server::handleResign,         0, 0, true);
+    reg(CMD_GAME_MOVE,      "GAME_MOVE",      &Server::handleGameMove,       sizeof(MovePayload), sizeof(MovePayload), true);
+    reg(CMD_QUEUE_JOIN,     "QUEUE_JOIN",     &Server::handleQueueJoin,      0, 0, true);
+    reg(CMD_QUEUE_LEAVE,    "QUEUE_LEAVE",    &Server::handleQueueLeave,     0, 0, true);
+    reg(CMD_TOGGLE_PAUSE,   "TOGGLE_PAUSE",   &Server::handleTogglePause,    0, 0, true);
+    reg(CMD_FRIEND_ADD,     "FRIEND_ADD",     &Server::handleFriendAdd,      target, target, true);
+    reg(CMD_FRIEND_ACCEPT,  "FRIEND_ACCEPT",  &Server::handleFriendAccept,   target, target, true);
+    reg(CMD_FRIEND_REMOVE,  "FRIEND_REMOVE",  &Server::handleFriendRemove,   target, target, true);
+    reg(CMD_FRIEND_LIST,    "FRIEND_LIST",    &Server::handleFriendList,     0, 0, true);
+    reg(CMD_HELLO,          "HELLO",          &Server::handleHello,          sizeof(HelloPacket), sizeof(HelloPacket), false);
+    reg(CMD_STATE_RESYNC,   "STATE_RESYNC",   &Server::handleStateResync,    sizeof(uint32_t), sizeof(uint32_t), true);
+    reg(CMD_BATCH,          "BATCH",          &Server::handleBatch,          sizeof(PacketHeader), MAX_PACKET_SIZE, false);
+}
+
+void Server::processPacket(int client, Connection& conn, PacketHeader& header, const PacketView& body) {
+    // One indexed lookup validates and dispatches; unknown commands have no handler
+    CommandEntry& entry = commandTable[header.command];
+    if (conn.registering) {
+        // Later packets may depend on the login, so they wait their turn
+        size_t size = sizeof(header) + body.size;
+        if (conn.heldBytes + size > MAX_HELD_BYTES) {
+            entry.rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-    } else if (header.command == CMD_LIST_USERS) {
-        std::string list;
-        for (const auto& pair : authenticatedUsers) list += pair.second + "\n";
-        PacketHeader resp = {(uint32_t)list.size(), CMD_LIST_USERS_RESP};
-        sendPacket(client, &resp, sizeof(resp));
-        if (!list.empty()) sendPacket(client, list.c_str(), list.size());
-    } else if (header.command == CMD_LEADERBOARD) {
-        std::string board = userManager.getLeaderboard();
-        PacketHeader resp = {(uint32_t)board.size(), CMD_LEADERBOARD_RESP};
-        sendPacket(client, &resp, sizeof(resp));
-        if (!board.empty()) sendPacket(client, board.c_str(), board.size());
-    } else if (header.command == CMD_CHALLENGE_REQ) {
-        if (header.size == sizeof(ChallengePacket)) {
-            ChallengePacket* pkt = (ChallengePacket*)body.data();
-            std::string target(pkt->targetUser);
-            int targetSock = getSocketByUsername(target);
-            if (targetSock != -1) {
-                std::string sender = authenticatedUsers[client];
-                if (pendingChallenges.count(target) && pendingChallenges[target] == sender) {
-                    pendingChallenges.erase(target);
-                    // Fetch elos
-                    auto u1 = userManager.getUser(target);
-                    auto u2 = userManager.getUser(sender);
-                    int e1 = u1 ? u1->elo : 1000;
-                    int e2 = u2 ? u2->elo : 1000;
-
-                    auto game = std::make_shared<GameSession>(target, sender, targetSock, client, e1, e2);
-                    activeGames.push_back(game);
-                    
-                    GameStatePacket state = game->getState();
-                    PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                    
-                    sendPacket(targetSock, &h, sizeof(h));
-                    sendPacket(targetSock, &state, sizeof(state));
-                    sendPacket(client, &h, sizeof(h));
-                    sendPacket(client, &state, sizeof(state));
+        std::string packet((const char*)&header, sizeof(header));
+        packet.append(body.data, body.size);
+        conn.heldPackets.push_back(std::move(packet));
+        conn.heldBytes += size;
+        return;
+    }
+    if (!entry.handler || header.size < entry.minSize || header.size > entry.maxSize
+        || (entry.requiresAuth && !conn.isAuthenticated())) {
+        entry.rejected.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Batches dispatch through here too; restore the outer context afterwards
+    ReplyContext outer = replyTo;
+    bool tagged = (conn.features & FEATURE_REQUEST_IDS) && (header.flags & HEADER_FLAG_REQUEST_ID);
+    replyTo.client = client;
+    replyTo.requestId = tagged ? header.requestId : 0;
+
+    auto start = std::chrono::steady_clock::now();
+    (this->*entry.handler)(client, conn, body);
+    replyTo = outer;
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    entry.calls.fetch_add(1, std::memory_order_relaxed);
+    entry.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = entry.maxNs.load(std::memory_order_relaxed);
+    while (ns > max && !entry.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+void Server::dumpCommandMetrics() {
+    for (CommandEntry& e : commandTable) {
+        if (!e.name) continue;
+        // Packets handled while this runs count towards the next dump
+        uint64_t calls = e.calls.exchange(0), rejected = e.rejected.exchange(0);
+        uint64_t totalNs = e.totalNs.exchange(0), maxNs = e.maxNs.exchange(0);
+        if (calls == 0 && rejected == 0) continue;
+        std::cout << "[metrics] " << e.name << ": " << calls << " calls, " << rejected << " rejected";
+        if (calls) std::cout << ", avg " << (totalNs / calls / 1000) << "us, max " << (maxNs / 1000) << "us";
+        std::cout << std::endl;
+    }
+}
+
+void Server::handleRegister(int client, Connection& conn, const PacketView& body) {
+    LoginRequest req;
+    if (!body.read(req)) return;
+    std::string username = fixedString(req.username);
+    DeferredReply deferred = deferReply(client);
+    // Answered once the new row is committed
+    conn.registering = true;
+    userManager.registerUser(username, fixedString(req.password), [this, deferred, username](bool created) {
+        // Back on the connection's own reactor: the reply touches its session half
+        socketServer.post(deferred.ref.fd, [this, deferred, username, created]() {
+            completeReply(deferred, [&](int client, Connection& conn) {
+                conn.registering = false;
+                if (created && !conn.isAuthenticated()) {
+                    auto user = userManager.getUser(username);
+                    UserStats stats = { user->elo, user->wins, user->losses };
+                    sendPacket(client, CMD_LOGIN_SUCCESS, &stats, sizeof(stats));
+
+                    bindUser(client, conn, username);
+                    sendUserList(client);
+                    std::cout << "Registered: " << username << std::endl;
                 } else {
-                    pendingChallenges[sender] = target;
-                    ChallengePacket fwd;
-                    strncpy(fwd.targetUser, sender.c_str(), 32);
-                    PacketHeader h = {(uint32_t)sizeof(fwd), CMD_CHALLENGE_REQ};
-                    sendPacket(targetSock, &h, sizeof(h));
-                    sendPacket(targetSock, &fwd, sizeof(fwd));
+                    sendPacket(client, CMD_FAIL, nullptr, 0);
                 }
-            }
-        }
-    } else if (header.command == CMD_CHALLENGE_RESP) {
-        if (header.size == sizeof(ChallengePacket)) {
-            ChallengePacket* pkt = (ChallengePacket*)body.data();
-            std::string origChallenger(pkt->targetUser);
-            int challSock = getSocketByUsername(origChallenger);
-            if (challSock != -1) {
-                 std::string p1Name = origChallenger;
-                 std::string p2Name = authenticatedUsers[client];
-                 auto u1 = userManager.getUser(p1Name);
-                 auto u2 = userManager.getUser(p2Name);
-                 int e1 = u1 ? u1->elo : 1000;
-                 int e2 = u2 ? u2->elo : 1000;
-
-                 auto game = std::make_shared<GameSession>(p1Name, p2Name, challSock, client, e1, e2);
-                 activeGames.push_back(game);
-                 
-                 GameStatePacket state = game->getState();
-                 PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                 sendPacket(challSock, &h, sizeof(h));
-                 sendPacket(challSock, &state, sizeof(state));
-                 sendPacket(client, &h, sizeof(h));
-                 sendPacket(client, &state, sizeof(state));
-            }
-        }
-    } else if (header.command == CMD_PLAY_AI) {
-        if (!getGameSession(client)) {
-            std::string p1 = authenticatedUsers[client];
-            auto u1 = userManager.getUser(p1);
-            int e1 = u1 ? u1->elo : 1000;
-            auto game = std::make_shared<GameSession>(p1, "The Dealer", client, -1, e1, 9999); // Dealer has high elo?
-            activeGames.push_back(game);
-            
-             GameStatePacket state = game->getState();
-             PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-             sendPacket(client, &h, sizeof(h));
-             sendPacket(client, &state, sizeof(state));
+                releaseHeldPackets(client, conn);
+            });
+        });
+    });
+}
+
+void Server::releaseHeldPackets(int client, Connection& conn) {
+    std::vector<std::string> held;
+    held.swap(conn.heldPackets);
+    conn.heldBytes = 0;
+    for (const std::string& packet : held) {
+        // Another CMD_REGISTER among them holds the rest again
+        PacketHeader header;
+        memcpy(&header, packet.data(), sizeof(header));
+        processPacket(client, conn, header, PacketView{packet.data() + sizeof(header), header.size});
+        if (!socketServer.getConnection(client)) return; // Closed by a handler
+    }
+}
+
+void Server::handleLogin(int client, Connection& conn, const PacketView& body) {
+    LoginRequest req;
+    if (!body.read(req)) return;
+    std::string username = fixedString(req.username);
+    bool success = userManager.loginUser(username, fixedString(req.password));
+    if (success) {
+        // Fetch stats
+        auto user = userManager.getUser(username);
+        UserStats stats = { user->elo, user->wins, user->losses };
+        sendPacket(client, CMD_LOGIN_SUCCESS, &stats, sizeof(stats));
+
+        bindUser(client, conn, username);
+        sendUserList(client);
+        std::cout << "Logged in: " << username << std::endl;
+    } else {
+        sendPacket(client, CMD_FAIL, nullptr, 0);
+    }
+}
+
+void Server::handleListUsers(int client, Connection&, const PacketView&) {
+    sendUserList(client);
+}
+
+void Server::handleLeaderboard(int client, Connection&, const PacketView&) {
+    replyAsync(client, CMD_LEADERBOARD_RESP, [this]() { return userManager.getLeaderboard(); });
+}
+
+void Server::handleChallengeReq(int client, Connection& conn, const PacketView& body) {
+    ChallengePacket pkt;
+    if (!body.read(pkt)) return;
+    std::string target = fixedString(pkt.targetUser);
+    std::string sender = conn.username;
+    if (target == sender) return;
+    ConnectionRef targetRef = getUserRef(target);
+    if (targetRef.fd == -1 || sessionOf(conn) || inSession(targetRef.fd)) return;
+
+    bool mutual;
+    {
+        std::lock_guard<std::mutex> lock(challengesMutex);
+        auto it = pendingChallenges.find(target);
+        mutual = it != pendingChallenges.end() && it->second == sender;
+        if (mutual) pendingChallenges.erase(it);
+        else pendingChallenges[sender] = target;
+    }
+    if (mutual) {
+        // Fetch elos
+        auto u1 = userManager.getUser(target);
+        auto u2 = userManager.getUser(sender);
+        int e1 = u1 ? u1->elo : 1000;
+        int e2 = u2 ? u2->elo : 1000;
+
+        auto game = std::make_shared<GameSession>(target, sender, targetRef.fd, client, e1, e2);
+        startSession(game, targetRef, ConnectionRef{client, conn.generation});
+    } else {
+        ChallengePacket fwd;
+        strncpy(fwd.targetUser, sender.c_str(), 32);
+        sendPacket(targetRef.fd, CMD_CHALLENGE_REQ, &fwd, sizeof(fwd));
+    }
+}
+
+void Server::handleChallengeResp(int client, Connection& conn, const PacketView& body) {
+    ChallengePacket pkt;
+    if (!body.read(pkt)) return;
+    std::string origChallenger = fixedString(pkt.targetUser);
+    ConnectionRef challRef = getUserRef(origChallenger);
+    if (challRef.fd == -1 || sessionOf(conn) || inSession(challRef.fd)) return;
+
+    std::string p1Name = origChallenger;
+    std::string p2Name = conn.username;
+    auto u1 = userManager.getUser(p1Name);
+    auto u2 = userManager.getUser(p2Name);
+    int e1 = u1 ? u1->elo : 1000;
+    int e2 = u2 ? u2->elo : 1000;
+
+    auto game = std::make_shared<GameSession>(p1Name, p2Name, challRef.fd, client, e1, e2);
+    startSession(game, challRef, ConnectionRef{client, conn.generation});
+}
+
+void Server::handlePlayAi(int client, Connection& conn, const PacketView&) {
+    if (sessionOf(conn)) return;
+    std::string p1 = conn.username;
+    auto u1 = userManager.getUser(p1);
+    int e1 = u1 ? u1->elo : 1000;
+    auto game = std::make_shared<GameSession>(p1, "The Dealer", client, -1, e1, 9999); // Dealer has high elo?
+    startSession(game, ConnectionRef{client, conn.generation}, ConnectionRef());
+}
+
+void Server::handleListReplays(int client, Connection& conn, const PacketView&) {
+    std::string user = conn.username;
+    replyAsync(client, CMD_LIST_REPLAYS_RESP, [user]() { return ReplayManager::getReplayList(user); });
+}
+
+void Server::handleGetReplay(int client, Connection&, const PacketView& body) {
+    auto replay = ReplayManager::openReplay(body.str());
+    uint32_t frames = replay ? replay->totalFrames : 0;
+    sendReplayFrames(client, CMD_REPLAY_DATA, nullptr, 0, replay, 0, frames);
+}
+
+void Server::handleGetReplayChunk(int client, Connection&, const PacketView& body) {
+    // One bounded chunk per request; the client decides how many to keep in flight
+    ReplayChunkRequest req;
+    if (!body.read(req)) return;
+    std::string fname(body.data + sizeof(req), body.size - sizeof(req));
+
+    auto replay = ReplayManager::openReplay(fname);
+    ReplayChunkHeader chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.firstFrame = req.firstFrame;
+    if (replay) {
+        chunk.totalFrames = replay->totalFrames;
+        if (req.firstFrame < replay->totalFrames) {
+            chunk.frameCount = std::min({req.frameCount, REPLAY_CHUNK_FRAMES, replay->totalFrames - req.firstFrame});
         }
-    } else if (header.command == CMD_LIST_REPLAYS) {
-        std::string list = ReplayManager::getReplayList(authenticatedUsers[client]);
-        PacketHeader resp = {(uint32_t)list.size(), CMD_LIST_REPLAYS_RESP};
-        sendPacket(client, &resp, sizeof(resp));
-        if(!list.empty()) sendPacket(client, list.c_str(), list.size());
-    } else if (header.command == CMD_GET_REPLAY) {
-        std::string fname(body.begin(), body.end());
-        auto hist = ReplayManager::loadReplay(fname);
-        PacketHeader resp = {(uint32_t)(hist.size() * sizeof(GameStatePacket)), CMD_REPLAY_DATA};
-        sendPacket(client, &resp, sizeof(resp));
-        if(!hist.empty()) sendPacket(client, hist.data(), resp.size);
-    } else if (header.command == CMD_GET_HISTORY) {
-         auto hist = userManager.getHistory(authenticatedUsers[client]);
-         PacketHeader resp = {(uint32_t)(hist.size()*sizeof(HistoryEntry)), CMD_HISTORY_DATA};
-         sendPacket(client, &resp, sizeof(resp));
-         if(!hist.empty()) sendPacket(client, hist.data(), resp.size);
-    } else if (header.command == CMD_RESIGN) {
-        auto game = getGameSession(client);
-        if (game) {
-            game->resign(authenticatedUsers[client]);
-            
-             if (game->isGameOver()) {
-                 std::string winner = game->getState().winner;
-                 std::string lose = (winner == game->getP1Name()) ? game->getP2Name() : game->getP1Name();
-                 std::string replay = ReplayManager::saveReplay(game->getP1Name(), game->getP2Name(), winner, game->getHistory());
-                 auto deltas = userManager.recordMatch(winner, lose, replay);
-                 game->setEloChanges((winner==game->getP1Name())?deltas.first : deltas.second, (winner==game->getP2Name())?deltas.first : deltas.second);
-             }
-
-             GameStatePacket state = game->getState();
-             PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-             sendPacket(game->getP1Socket(), &h, sizeof(h));
-             sendPacket(game->getP1Socket(), &state, sizeof(state));
-             sendPacket(game->getP2Socket(), &h, sizeof(h));
-             sendPacket(game->getP2Socket(), &state, sizeof(state));
-             
-             if (game->isGameOver()) {
-                 auto it = std::find(activeGames.begin(), activeGames.end(), game);
-                 if (it!=activeGames.end()) activeGames.erase(it);
-             }
+    }
+    sendReplayFrames(client, CMD_REPLAY_CHUNK, &chunk, sizeof(chunk), replay, chunk.firstFrame, chunk.frameCount);
+}
+
+void Server::sendReplayFrames(int client, uint8_t command, const void* prefix, size_t prefixSize,
+                              const std::shared_ptr<ReplayFile>& replay, uint32_t firstFrame, uint32_t frameCount) {
+    // The frames go from the file to the socket with sendfile(); only the header is built here
+    size_t length = (size_t)frameCount * sizeof(GameStatePacket);
+    uint16_t requestId = client == replyTo.client ? replyTo.requestId : 0;
+    std::vector<OutboundPtr> msgs;
+    msgs.push_back(OutboundMessage::prefix(command, prefix, prefixSize, length, requestId));
+    if (length > 0) msgs.push_back(OutboundMessage::file(replay, replay->fd, ReplayFile::frameOffset(firstFrame), length));
+
+    if (Connection* conn = socketServer.getConnection(client)) {
+        conn->stats.packetsOut++;
+        conn->stats.bytesOut += sizeof(PacketHeader) + prefixSize + length;
+    }
+    socketServer.sendMessages(client, msgs);
+}
+
+void Server::handleGetHistory(int client, Connection& conn, const PacketView&) {
+    auto hist = userManager.getHistory(conn.username);
+    sendPacket(client, CMD_HISTORY_DATA, hist.data(), hist.size()*sizeof(HistoryEntry));
+}
+
+void Server::handleResign(int, Connection& conn, const PacketView&) {
+    auto game = sessionOf(conn);
+    if (!game) return;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->isGameOver()) return;
+    game->resign(conn.username);
+
+    sendGameState(game);
+
+    if (game->isGameOver()) finishGame(game);
+    else armSessionTimers(game);
+}
+
+void Server::handleGameMove(int, Connection& conn, const PacketView& body) {
+    MovePayload mv;
+    if (!body.read(mv)) return;
+    auto game = sessionOf(conn);
+    if (!game) return;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->isGameOver()) return;
+    game->processMove(conn.username, (MoveType)mv.moveType, (ItemType)mv.itemType);
+
+    sendGameState(game);
+
+    if (game->isGameOver()) finishGame(game);
+    else armSessionTimers(game);
+}
+
+void Server::handleQueueJoin(int client, Connection& conn, const PacketView&) {
+    if (sessionOf(conn)) {
+        sendPacket(client, CMD_FAIL, nullptr, 0);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (std::find(matchmakingQueue.begin(), matchmakingQueue.end(), conn.username) == matchmakingQueue.end()) {
+        matchmakingQueue.push_back(conn.username);
+    }
+    sendPacket(client, CMD_OK, nullptr, 0);
+}
+
+void Server::handleQueueLeave(int client, Connection& conn, const PacketView&) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    auto it = std::find(matchmakingQueue.begin(), matchmakingQueue.end(), conn.username);
+    if(it!=matchmakingQueue.end()) matchmakingQueue.erase(it);
+    sendPacket(client, CMD_OK, nullptr, 0);
+}
+
+void Server::handleTogglePause(int, Connection& conn, const PacketView&) {
+    auto game = sessionOf(conn);
+    if (!game) return;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->isAiGame() && !game->isGameOver()) {
+        game->togglePause();
+        sendGameState(game);
+        armSessionTimers(game);
+    }
+}
+
+UserManager::Completion Server::failOnError(int client) {
+    DeferredReply deferred = deferReply(client);
+    return [this, deferred](bool ok) {
+        if (ok) return;
+        socketServer.post([this, deferred]() {
+            completeReply(deferred, [&](int client, Connection&) { sendPacket(client, CMD_FAIL, nullptr, 0); });
+        });
+    };
+}
+
+void Server::handleFriendAdd(int client, Connection& conn, const PacketView& body) {
+    ChallengePacket pkt;
+    if (!body.read(pkt)) return;
+    std::string target = fixedString(pkt.targetUser);
+    std::string sender = conn.username;
+    // The target hears about it once the request is committed
+    UserManager::Completion onFail = failOnError(client);
+    userManager.addFriendRequest(sender, target, [this, sender, target, onFail](bool added) {
+        if (!added) {
+            onFail(false);
+            return;
         }
-    } else if (header.command == CMD_GAME_MOVE) {
-        if (header.size == sizeof(MovePayload)) {
-            MovePayload* mv = (MovePayload*)body.data();
-            auto game = getGameSession(client);
-            if (game) {
-                 game->processMove(authenticatedUsers[client], (MoveType)mv->moveType, (ItemType)mv->itemType);
-                 
-                 if (game->isGameOver()) {
-                      std::string winner = game->getState().winner;
-                      std::string lose = (winner == game->getP1Name()) ? game->getP2Name() : game->getP1Name();
-                      std::string replay = ReplayManager::saveReplay(game->getP1Name(), game->getP2Name(), winner, game->getHistory());
-                      auto deltas = userManager.recordMatch(winner, lose, replay);
-                      game->setEloChanges((winner==game->getP1Name())?deltas.first:deltas.second, (winner==game->getP2Name())?deltas.first:deltas.second);
-                 }
-
-                 GameStatePacket state = game->getState();
-                 PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-                 sendPacket(game->getP1Socket(), &h, sizeof(h));
-                 sendPacket(game->getP1Socket(), &state, sizeof(state));
-                 sendPacket(game->getP2Socket(), &h, sizeof(h));
-                 sendPacket(game->getP2Socket(), &state, sizeof(state));
-
-                 if (game->isGameOver()) {
-                      auto it = std::find(activeGames.begin(), activeGames.end(), game);
-                      if (it!=activeGames.end()) activeGames.erase(it);
-                 }
+        socketServer.post([this, sender, target]() {
+            int ts = getSocketByUsername(target);
+            if (ts != -1) {
+                ChallengePacket req; strncpy(req.targetUser, sender.c_str(), 32);
+                sendPacket(ts, CMD_FRIEND_REQ_INCOMING, &req, sizeof(req));
             }
+        });
+    });
+}
+
+void Server::handleFriendAccept(int client, Connection& conn, const PacketView& body) {
+    ChallengePacket pkt;
+    if (!body.read(pkt)) return;
+    userManager.acceptFriendRequest(conn.username, fixedString(pkt.targetUser), failOnError(client));
+}
+
+void Server::handleFriendRemove(int client, Connection& conn, const PacketView& body) {
+    ChallengePacket pkt;
+    if (!body.read(pkt)) return;
+    userManager.removeFriend(conn.username, fixedString(pkt.targetUser), failOnError(client));
+}
+
+void Server::handleFriendList(int client, Connection& conn, const PacketView&) {
+    DeferredReply deferred = deferReply(client);
+    userManager.getFriendList(conn.username, [this, deferred](std::string list) {
+        socketServer.post([this, deferred, list]() {
+            completeReply(deferred, [&](int client, Connection&) { sendFriendList(client, list); });
+        });
+    });
+}
+
+void Server::sendFriendList(int client, const std::string& list) {
+    // Accepted friends go out as ONLINE or OFFLINE
+    std::stringstream ss(list);
+    std::string item, finalList;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) continue;
+        auto colon = item.find(':');
+        if(colon != std::string::npos) {
+            std::string fname = item.substr(0, colon);
+            std::string stat = item.substr(colon+1);
+            if(stat == "ACCEPTED") {
+                 stat = getSocketByUsername(fname) != -1 ? "ONLINE" : "OFFLINE";
+            }
+            if(!finalList.empty()) finalList += ",";
+            finalList += fname + ":" + stat;
         }
-    } else if (header.command == CMD_QUEUE_JOIN) {
-         if (std::find(matchmakingQueue.begin(), matchmakingQueue.end(), authenticatedUsers[client]) == matchmakingQueue.end()) {
-             matchmakingQueue.push_back(authenticatedUsers[client]);
-         }
-         PacketHeader r = {0, CMD_OK};
-         sendPacket(client, &r, sizeof(r));
-    } else if (header.command == CMD_QUEUE_LEAVE) {
-        auto it = std::find(matchmakingQueue.begin(), matchmakingQueue.end(), authenticatedUsers[client]);
-        if(it!=matchmakingQueue.end()) matchmakingQueue.erase(it);
-        PacketHeader r = {0, CMD_OK};
-        sendPacket(client, &r, sizeof(r));
-    } else if (header.command == CMD_TOGGLE_PAUSE) {
-        auto game = getGameSession(client);
-        if (game && game->isAiGame()) {
-            game->togglePause();
-            GameStatePacket state = game->getState();
-            PacketHeader h = {(uint32_t)sizeof(state), CMD_GAME_STATE};
-            sendPacket(client, &h, sizeof(h));
-            sendPacket(client, &state, sizeof(state));
-        }
-    } else if (header.command == CMD_FRIEND_ADD) {
-        ChallengePacket* pkt = (ChallengePacket*)body.data();
-        std::string target = pkt->targetUser;
-        if(userManager.addFriendRequest(authenticatedUsers[client], target)) {
-             int ts = getSocketByUsername(target);
-             if (ts != -1) {
-                 ChallengePacket req; strncpy(req.targetUser, authenticatedUsers[client].c_str(), 32);
-                 PacketHeader h = {(uint32_t)sizeof(req), CMD_FRIEND_REQ_INCOMING};
-                 sendPacket(ts, &h, sizeof(h));
-                 sendPacket(ts, &req, sizeof(req));
-             }
+    }
+    sendPacket(client, CMD_FRIEND_LIST_RESP, finalList.c_str(), finalList.size());
+}
+
+void Server::handleHello(int client, Connection& conn, const PacketView& body) {
+    HelloPacket req;
+    if (!body.read(req)) return;
+    HelloPacket resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.version = std::min<uint16_t>(req.version, PROTOCOL_VERSION);
+    resp.features = resp.version >= 2 ? (req.features & SUPPORTED_FEATURES) : 0;
+    // Delta streams carry player indexes and event codes, not text, and only
+    // send the state when it changes, so the clock has to come from CMD_TIMER_SYNC
+    if (!(resp.features & FEATURE_COMPACT_EVENTS) || !(resp.features & FEATURE_TIMER_SYNC)) {
+        resp.features &= ~FEATURE_STATE_DELTA;
+    }
+
+    conn.protocolVersion = resp.version;
+    conn.features = resp.features;
+    sendPacket(client, CMD_HELLO, &resp, sizeof(resp));
+    socketServer.setBatchOutput(client, (resp.features & FEATURE_BATCH) != 0);
+}
+
+void Server::handleStateResync(int client, Connection& conn, const PacketView& body) {
+    uint32_t sessionId;
+    memcpy(&sessionId, body.data, sizeof(sessionId));
+    auto game = sessionOf(conn);
+    if (!game || game->getId() != sessionId || !(conn.features & FEATURE_STATE_DELTA)) return;
+    std::lock_guard<std::mutex> gameLock(game->mutex);
+    StateStream* stream;
+    {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = stateStreams.find(game.get());
+        if (it == stateStreams.end()) return;
+        stream = &it->second;
+    }
+
+    // Restart this client's stream from the last state everyone was sent
+    sendPacket(client, encodeState(sessionId, stream->sequence, true, stream->last, stream->last));
+    std::lock_guard<std::mutex> lock(conn.sessionMutex);
+    if (conn.session == game) conn.keyframeSession = sessionId;
+}
+
+void Server::handleBatch(int client, Connection& conn, const PacketView& body) {
+    if (!(conn.features & FEATURE_BATCH)) return;
+
+    // The envelope is free; every packet inside it pays like a standalone one.
+    // The refund never lifts the bucket past its burst size.
+    conn.rateTokens = std::min(conn.rateTokens + 1.0, RATE_BURST);
+    const char* p = body.data;
+    const char* end = body.data + body.size;
+    while ((size_t)(end - p) >= sizeof(PacketHeader)) {
+        PacketHeader header;
+        memcpy(&header, p, sizeof(header));
+        if (header.size > (size_t)(end - p) - sizeof(header) || header.command == CMD_BATCH) {
+            commandTable[CMD_BATCH].rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-    } else if (header.command == CMD_FRIEND_ACCEPT) {
-        ChallengePacket* pkt = (ChallengePacket*)body.data();
-        userManager.acceptFriendRequest(authenticatedUsers[client], pkt->targetUser);
-    } else if (header.command == CMD_FRIEND_REMOVE) {
-        ChallengePacket* pkt = (ChallengePacket*)body.data();
-        userManager.removeFriend(authenticatedUsers[client], pkt->targetUser);
-    } else if (header.command == CMD_FRIEND_LIST) {
-        std::string user = authenticatedUsers[client];
-        std::string list = userManager.getFriendList(user);
-        std::stringstream ss(list);
-        std::string item, finalList;
-        while(std::getline(ss, item, ',')) {
-            if(item.empty()) continue;
-            auto colon = item.find(':');
-            if(colon != std::string::npos) {
-                std::string fname = item.substr(0, colon);
-                std::string stat = item.substr(colon+1);
-                if(stat == "ACCEPTED") {
-                     stat = getSocketByUsername(fname) != -1 ? "ONLINE" : "OFFLINE";
-                }
-                if(!finalList.empty()) finalList += ",";
-                finalList += fname + ":" + stat;
-            }
+        if (conn.rateTokens < 1.0) {
+            std::cout << "Packet flood, disconnecting " << client << std::endl;
+            socketServer.closeSocket(client);
+            return;
         }
-        PacketHeader resp = {(uint32_t)finalList.size(), CMD_FRIEND_LIST_RESP};
-        sendPacket(client, &resp, sizeof(resp));
-        if(!finalList.empty()) sendPacket(client, finalList.c_str(), finalList.size());
+        conn.rateTokens -= 1.0;
+
+        processPacket(client, conn, header, PacketView{p + sizeof(header), header.size});
+        p += sizeof(header) + header.size;
     }
 }
 
-void Server::broadcastUserList() {
+std::string Server::userList() {
+    std::lock_guard<std::mutex> lock(usersMutex);
+    return userListLocked();
+}
+
+std::string Server::userListLocked() const {
     std::string list;
-    for (auto& pair : authenticatedUsers) list += pair.second + "\n";
-    PacketHeader resp = {(uint32_t)list.size(), CMD_LIST_USERS_RESP};
-    for (auto& pair : authenticatedUsers) {
-        sendPacket(pair.first, &resp, sizeof(resp));
-        if(!list.empty()) sendPacket(pair.first, list.c_str(), list.size());
+    for (const auto& pair : socketByUser) list += pair.first + "\n";
+    return list;
+}
+
+void Server::sendUserList(int client) {
+    std::string list = userList();
+    sendPacket(client, CMD_LIST_USERS_RESP, list.c_str(), list.size());
+}
+
+void Server::queuePresence(const std::string& username, bool online) {
+    // Only the latest state per name matters by the time the tick fires
+    pendingPresence[username] = online;
+    if (presenceTimer != INVALID_TIMER) return;
+    presenceTimer = socketServer.addOneShotTimer(PRESENCE_FLUSH_MS, [this]() {
+        std::lock_guard<std::mutex> lock(usersMutex);
+        flushPresence();
+    });
+}
+
+void Server::flushPresence() {
+    presenceTimer = INVALID_TIMER;
+    std::string online, offline;
+    for (const auto& pair : pendingPresence) {
+        (pair.second ? online : offline) += pair.first + "\n";
+    }
+    pendingPresence.clear();
+
+    // Encoded once, shared by every recipient
+    OutboundPtr onMsg = online.empty() ? nullptr : OutboundMessage::make(CMD_USER_ONLINE, online.data(), online.size());
+    OutboundPtr offMsg = offline.empty() ? nullptr : OutboundMessage::make(CMD_USER_OFFLINE, offline.data(), offline.size());
+    OutboundPtr listMsg; // Built on first use: only clients without deltas need it
+    for (const auto& pair : socketByUser) {
+        Connection* conn = socketServer.getConnection(pair.second);
+        if (!conn) continue;
+        if (conn->features & FEATURE_PRESENCE_DELTA) {
+            if (onMsg) sendPacket(pair.second.fd, onMsg);
+            if (offMsg) sendPacket(pair.second.fd, offMsg);
+        } else {
+            if (!listMsg) {
+                std::string list = userListLocked();
+                listMsg = OutboundMessage::make(CMD_LIST_USERS_RESP, list.data(), list.size());
+            }
+            sendPacket(pair.second.fd, listMsg);
+        }
     }
 }
 
@@ -1,17 +1,44 @@
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "UserManager.h"
 #include "GameSession.h"
 #include "SocketServer.h"
+#include "ReplayManager.h"
+#include "PersistenceWorker.h"
+#include "WorkerPool.h"
 #include <chrono>
 
 namespace Buckshot {
 
+// Non-owning view of a packet body. It points into the connection's receive
+// buffer and is only valid for the duration of the handler call.
+struct PacketView {
+    const char* data = nullptr;
+    uint32_t size = 0;
+
+    // Copies a wire struct out of the view; false if the payload is too short.
+    // The receive buffer carries no alignment guarantee, so structs are never
+    // read in place.
+    template <typename T>
+    bool read(T& out) const {
+        if (size < sizeof(T)) return false;
+        memcpy(&out, data, sizeof(T));
+        return true;
+    }
+    std::string str() const { return std::string(data, size); }
+};
+
 class Server {
 public:
-    explicit Server(int port);
+    Server(int port, int reactorCount = 1, int workerCount = 2, const DatabaseOptions& dbOptions = DatabaseOptions());
     void run();
 
 private:
@@ -19,43 +46,202 @@ private:
     bool running;
     
     SocketServer socketServer;
-    
-    // Connected clients (socket FD -> buffer)
-    std::map<int, std::vector<char>> clientBuffers;
 
+    // Reactors run callbacks concurrently; there is no lock around a whole callback.
+    // - A connection's session half belongs to its reactor (see Connection). Work for
+    //   it from elsewhere is posted there with SocketServer::post(fd, ...).
+    // - Each GameSession has its own mutex, held while the game is read or advanced.
+    //   A game whose players sit on different reactors is advanced by whichever one
+    //   received the move; sends are reactor-agnostic.
+    // - Shared lobby state is split by what it guards: usersMutex (name index and
+    //   presence), challengesMutex, queueMutex and sessionsMutex (per-session maps).
+    // Lock order: queueMutex, then a GameSession's mutex, then usersMutex /
+    // challengesMutex / sessionsMutex (never two of these at once, except
+    // queueMutex -> usersMutex), then Connection::sessionMutex.
+    std::mutex usersMutex;
+    std::mutex challengesMutex;
+    std::mutex queueMutex;
+    std::mutex sessionsMutex;
+    
     UserManager userManager;
+    // Replays and match results are written here, off the reactors.
+    // Declared after userManager so it is stopped (and drained) first.
+    PersistenceWorker persistence;
+    // Finished sessions whose result is being written, by session id (sessionsMutex)
+    std::unordered_map<uint32_t, std::shared_ptr<GameSession>> savingResults;
+    // CPU-heavy request work (leaderboard, replay listing); completions are posted to reactor 0
+    WorkerPool workers;
     
     // session state
-    std::map<int, std::string> authenticatedUsers; 
-    std::vector<std::shared_ptr<GameSession>> activeGames;
-    std::chrono::steady_clock::time_point lastTimeoutCheck;
-    std::chrono::steady_clock::time_point lastMatchmakingBatch;
-    std::chrono::steady_clock::time_point lastStateBroadcast;
+    // Per-socket state (username, session, rate limit) lives in the SocketServer's
+    // Connection record; socketByUser is the reverse index for lookups by name
+    std::unordered_map<std::string, ConnectionRef> socketByUser; // username -> connection (usersMutex)
+    std::unordered_set<std::shared_ptr<GameSession>> activeGames; // sessionsMutex
+
+    // Inbound packet budget per connection (token bucket)
+    static constexpr double RATE_PER_SECOND = 1000.0;
+    static constexpr double RATE_BURST = 2000.0;
+    // Cap on packets held back behind a pending CMD_REGISTER; past it they are dropped
+    static constexpr size_t MAX_HELD_BYTES = 2 * MAX_PACKET_SIZE;
+
+    // Per-session deadlines, so timers only touch sessions that are due.
+    // The maps below are indexed under sessionsMutex; an entry's contents belong
+    // to its session and are only used under that session's mutex.
+    struct SessionTimers {
+        TimerId afk = INVALID_TIMER;   // Turn timeout
+        TimerId ai = INVALID_TIMER;    // Dealer's think delay
+        TimerId clock = INVALID_TIMER; // 1s state resend, while a player lacks FEATURE_TIMER_SYNC
+        // Last turn clock sent to the players (CMD_TIMER_SYNC)
+        bool synced = false;
+        bool syncedPaused = false;
+        std::chrono::steady_clock::time_point syncedDeadline;
+    };
+    std::unordered_map<GameSession*, SessionTimers> sessionTimers;
+
+    // Last state sent per session, the baseline for FEATURE_STATE_DELTA clients
+    struct StateStream {
+        StreamState last;
+        uint32_t sequence = 0;
+    };
+    std::unordered_map<GameSession*, StateStream> stateStreams;
+    static constexpr uint32_t SUPPORTED_FEATURES = FEATURE_STATE_DELTA | FEATURE_COMPACT_EVENTS | FEATURE_BATCH
+                                                  | FEATURE_REQUEST_IDS | FEATURE_REPLAY_STREAM
+                                                  | FEATURE_PRESENCE_DELTA | FEATURE_TIMER_SYNC;
 
     void onConnect(int clientFd);
-    void onData(int clientFd, const char* data, size_t size);
+    void onData(int clientFd, RingBuffer& in);
     void onDisconnect(int clientFd);
     
     void startGameloop();
+
+    // Session lifecycle. Apart from startSession, these require the game's mutex.
+    // startSession attaches both players (refs checked, so neither may have left
+    // or been replaced) and fails if either already has a session.
+    bool startSession(const std::shared_ptr<GameSession>& game, const ConnectionRef& p1, const ConnectionRef& p2);
+    void endSession(const std::shared_ptr<GameSession>& game);
+    // A player stays in their session until its result is recorded, and may not
+    // start another game before then
+    std::shared_ptr<GameSession> sessionOf(Connection& conn);
+    bool inSession(int sock);
+    void armSessionTimers(const std::shared_ptr<GameSession>& game); // Call whenever a deadline may have moved
+    void onSessionTimeout(const std::shared_ptr<GameSession>& game);
+    void onSessionAiTurn(const std::shared_ptr<GameSession>& game);
+    // Game over: hands the result to the persistence worker. The session ends
+    // (and the Elo changes go out) in onResultRecorded once it is saved.
+    void finishGame(const std::shared_ptr<GameSession>& game);
+    void onResultRecorded(const PersistenceWorker::MatchRecorded& recorded);
+    void sendGameState(const std::shared_ptr<GameSession>& game);
+    void sendTimerSync(const std::shared_ptr<GameSession>& game);
+    // Fresh CMD_GAME_STATE for the players without FEATURE_TIMER_SYNC, whose clock
+    // only moves with the state
+    void sendClockState(const std::shared_ptr<GameSession>& game);
+    bool clockSynced(const std::shared_ptr<GameSession>& game); // Every player has FEATURE_TIMER_SYNC
+    OutboundPtr encodeState(uint32_t sessionId, uint32_t sequence, bool keyframe,
+                            const StreamState& prev, const StreamState& next);
     
-    void broadcastUserList();
-    void processPacket(int client, PacketHeader& header, const std::vector<char>& body);
+    // Presence: a full list goes out once at login, after that only changes.
+    // Changes are coalesced and flushed once per PRESENCE_FLUSH_MS: as deltas to
+    // FEATURE_PRESENCE_DELTA clients, as a fresh full list to everyone else.
+    static constexpr int PRESENCE_FLUSH_MS = 100;
+    std::unordered_map<std::string, bool> pendingPresence; // username -> online (usersMutex)
+    TimerId presenceTimer = INVALID_TIMER;                 // usersMutex
+    std::string userList(); // Newline-separated names of everyone logged in
+    std::string userListLocked() const; // Same; requires usersMutex
+    void sendUserList(int client);
+    void sendFriendList(int client, const std::string& list);
+    void queuePresence(const std::string& username, bool online); // Requires usersMutex
+    void flushPresence(); // Requires usersMutex
+    void processPacket(int client, Connection& conn, PacketHeader& header, const PacketView& body);
+    void releaseHeldPackets(int client, Connection& conn); // Once a CMD_REGISTER is answered
+
+    // Command dispatch: one entry per Command byte. processPacket checks the payload
+    // size and auth requirement from the entry, then jumps straight to the handler.
+    using Handler = void (Server::*)(int client, Connection& conn, const PacketView& body);
+    struct CommandEntry {
+        Handler handler = nullptr;     // nullptr = unknown command, dropped
+        const char* name = nullptr;
+        uint32_t minSize = 0;          // Accepted payload size range
+        uint32_t maxSize = 0;
+        bool requiresAuth = false;
+        // Metrics since the last dump, bumped by every reactor
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> totalNs{0};
+        std::atomic<uint64_t> maxNs{0};
+    };
+    std::array<CommandEntry, 256> commandTable;
+    // Request being handled on this thread: packets sent back to its client echo its id (0 = none)
+    struct ReplyContext {
+        int client = -1;
+        uint16_t requestId = 0;
+    };
+    static thread_local ReplyContext replyTo;
+    void registerHandlers();
+    void dumpCommandMetrics();
+
+    void handleRegister(int client, Connection& conn, const PacketView& body);
+    void handleLogin(int client, Connection& conn, const PacketView& body);
+    void handleListUsers(int client, Connection& conn, const PacketView& body);
+    void handleLeaderboard(int client, Connection& conn, const PacketView& body);
+    void handleChallengeReq(int client, Connection& conn, const PacketView& body);
+    void handleChallengeResp(int client, Connection& conn, const PacketView& body);
+    void handlePlayAi(int client, Connection& conn, const PacketView& body);
+    void handleListReplays(int client, Connection& conn, const PacketView& body);
+    void handleGetReplay(int client, Connection& conn, const PacketView& body);
+    void handleGetReplayChunk(int client, Connection& conn, const PacketView& body);
+    void handleGetHistory(int client, Connection& conn, const PacketView& body);
+    void handleResign(int client, Connection& conn, const PacketView& body);
+    void handleGameMove(int client, Connection& conn, const PacketView& body);
+    void handleQueueJoin(int client, Connection& conn, const PacketView& body);
+    void handleQueueLeave(int client, Connection& conn, const PacketView& body);
+    void handleTogglePause(int client, Connection& conn, const PacketView& body);
+    void handleFriendAdd(int client, Connection& conn, const PacketView& body);
+    void handleFriendAccept(int client, Connection& conn, const PacketView& body);
+    void handleFriendRemove(int client, Connection& conn, const PacketView& body);
+    void handleFriendList(int client, Connection& conn, const PacketView& body);
+    void handleHello(int client, Connection& conn, const PacketView& body);
+    void handleStateResync(int client, Connection& conn, const PacketView& body);
+    void handleBatch(int client, Connection& conn, const PacketView& body);
     
     std::shared_ptr<GameSession> getGameSession(int client);
     
-    std::map<std::string, std::string> pendingChallenges; // Challenger -> Target
-    std::vector<std::string> matchmakingQueue; // Users waiting for match (Username)
+    std::map<std::string, std::string> pendingChallenges; // Challenger -> Target (challengesMutex)
+    std::vector<std::string> matchmakingQueue; // Users waiting for match (Username) (queueMutex)
     void processMatchmaking();
     
     // Security
     std::map<std::string, int> failedLoginAttempts; // IP -> Count
     std::map<std::string, std::chrono::steady_clock::time_point> ipLockout; // IP -> UnlockTime
     
-    // Helper to find socket by username
+    // Helpers to find a logged-in user's connection; -1 / fd -1 if they are offline
     int getSocketByUsername(const std::string& username);
+    ConnectionRef getUserRef(const std::string& username);
+    void bindUser(int client, Connection& conn, const std::string& username); // On login/register
+    void unbindUser(int client, Connection& conn);                            // On disconnect
     
-    // Helper to send using SocketServer
-    void sendPacket(int client, const void* data, size_t size);
+    // Helpers to send using SocketServer; each call is one framed packet
+    void sendPacket(int client, const OutboundPtr& msg);
+    void sendPacket(int client, uint8_t command, const void* body, size_t size);
+    // Builds the reply body on the worker pool and sends it back as one `command` packet,
+    // echoing the current request id. Dropped if the client has gone away by then.
+    void replyAsync(int client, uint8_t command, std::function<std::string()> work);
+
+    // The request being handled, kept for answering it after the handler returns
+    struct DeferredReply {
+        ConnectionRef ref;
+        uint16_t requestId = 0;
+    };
+    DeferredReply deferReply(int client);
+    // Runs reply with the request's id restored, unless the client has gone away.
+    // reply may only touch the connection's session half when this runs on the
+    // connection's reactor (post(fd, ...)); otherwise it should just send.
+    void completeReply(const DeferredReply& deferred, const std::function<void(int client, Connection& conn)>& reply);
+    // Completion for a queued database change: answers the request with CMD_FAIL
+    // if the change is refused or not committed, and with nothing otherwise
+    UserManager::Completion failOnError(int client);
+    // Header + prefix from memory, then frameCount frames straight from the replay file
+    void sendReplayFrames(int client, uint8_t command, const void* prefix, size_t prefixSize,
+                          const std::shared_ptr<ReplayFile>& replay, uint32_t firstFrame, uint32_t frameCount);
 
     /* [ASIO REFERENCE]
     // Asio
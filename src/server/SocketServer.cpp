@@ -6,18 +6,34 @@
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <algorithm>
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 
 #ifdef __linux__
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #else
 // Stub for non-Linux to allow compilation (will fail at runtime)
 #include <sys/types.h>
 #define EPOLLIN 0x001
+#define EPOLLOUT 0x004
+#define EPOLLERR 0x008
+#define EPOLLHUP 0x010
+#define EPOLLRDHUP 0x2000
+#define EPOLLET (1u << 31)
 #define EPOLL_CTL_ADD 1
 #define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
 #define epoll_create1(x) -1
 #define epoll_ctl(a,b,c,d) -1
 #define epoll_wait(a,b,c,d) -1
+#define timerfd_create(a,b) -1
+#define timerfd_settime(a,b,c,d) -1
+#define eventfd(a,b) -1
+struct itimerspec { struct timespec it_interval; struct timespec it_value; };
 struct epoll_event {
     uint32_t events;
     union {
@@ -31,51 +47,95 @@ struct epoll_event {
 
 #define MAX_EVENTS 1024
 #define BUFFER_SIZE 4096
+// Receive ring: starts at BUFFER_SIZE, may grow to hold one maximum-size packet
+#define MAX_INPUT_BUFFER (128 * 1024)
+// A client that lets this much unsent data pile up is too slow to keep; drop it
+#define MAX_PENDING_OUTPUT (4 * 1024 * 1024)
+// Queued messages gathered into one sendmsg() call
+#define MAX_IOVECS 64
+// Upper bound on the connection table, whatever RLIMIT_NOFILE says (containers often
+// report ~1e9, which would be gigabytes of empty slots)
+#define MAX_CONNECTION_SLOTS 65536
 
 namespace Buckshot {
 
-SocketServer::SocketServer(int port) : port(port), running(false), serverFd(-1), epollFd(-1) {
+// Reactor the current thread is running, so sends can tell local from cross-thread
+static thread_local const void* currentReactor = nullptr;
+
+SocketServer::SocketServer(int port, int reactorCount) : port(port), running(false) {
+    timerEpoch = std::chrono::steady_clock::now();
+    if (reactorCount < 1) reactorCount = 1;
+    for (int i = 0; i < reactorCount; ++i) {
+        auto reactor = std::make_unique<Reactor>();
+        reactor->index = i;
+        reactors.push_back(std::move(reactor));
+    }
+
+    // Size the connection table to the process fd limit, capped
+    struct rlimit limit;
+    size_t maxFds = MAX_CONNECTION_SLOTS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        maxFds = std::min((size_t)limit.rlim_cur, (size_t)MAX_CONNECTION_SLOTS);
+    }
+    connections = std::vector<std::atomic<Connection*>>(maxFds);
+    for (auto& slot : connections) slot.store(nullptr, std::memory_order_relaxed);
 }
 
 SocketServer::~SocketServer() {
     stop();
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) reactor->thread.join();
+        if (reactor->listenFd >= 0) close(reactor->listenFd);
+        if (reactor->epollFd >= 0) close(reactor->epollFd);
+        if (reactor->wakeFd >= 0) close(reactor->wakeFd);
+        reactor->listenFd = -1;
+        reactor->epollFd = -1;
+        reactor->wakeFd = -1;
+    }
+    if (timerFd >= 0) close(timerFd);
+    for (auto& slot : connections) delete slot.load(std::memory_order_relaxed);
 }
 
-void SocketServer::setupServer() {
+void SocketServer::setupReactor(Reactor& reactor) {
 #ifndef __linux__
     std::cerr << "CRITICAL ERROR: Epoll is only supported on Linux! This server will not run on macOS." << std::endl;
     exit(1);
 #endif
 
-    // 1. Create Server Socket
-    serverFd = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverFd < 0) {
+    // 1. Create Server Socket (one per reactor, sharded by SO_REUSEPORT)
+    reactor.listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (reactor.listenFd < 0) {
         perror("socket failed");
         exit(1);
     }
 
     int opt = 1;
-    setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(reactor.listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(reactor.listenFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0 && reactors.size() > 1) {
+        perror("setsockopt SO_REUSEPORT failed");
+        exit(1);
+    }
 
     struct sockaddr_in address;
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port);
 
-    if (bind(serverFd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    if (bind(reactor.listenFd, (struct sockaddr*)&address, sizeof(address)) < 0) {
         perror("bind failed");
         exit(1);
     }
 
     // Increased backlog to SOMAXCONN for high concurrency (C10k+)
-    if (listen(serverFd, SOMAXCONN) < 0) {
+    if (listen(reactor.listenFd, SOMAXCONN) < 0) {
         perror("listen failed");
         exit(1);
     }
+    setNonBlocking(reactor.listenFd);
 
     // 2. Create Epoll
-    epollFd = epoll_create1(0);
-    if (epollFd < 0) {
+    reactor.epollFd = epoll_create1(0);
+    if (reactor.epollFd < 0) {
         perror("epoll_create1 failed");
         exit(1);
     }
@@ -83,114 +143,528 @@ void SocketServer::setupServer() {
     // 3. Add Server Socket to Epoll
     struct epoll_event ev;
     ev.events = EPOLLIN;
-    ev.data.fd = serverFd;
-    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverFd, &ev) == -1) {
-        perror("epoll_ctl: serverFd");
+    ev.data.fd = reactor.listenFd;
+    if (epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, reactor.listenFd, &ev) == -1) {
+        perror("epoll_ctl: listenFd");
+        exit(1);
+    }
+
+    // 4. Wakeup channel (stop(), post() and cross-thread nudges)
+    reactor.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.wakeFd < 0) {
+        perror("eventfd failed");
         exit(1);
     }
-    
-    std::cout << "Server listening on port " << port << " (Epoll Mode)" << std::endl;
+    ev.events = EPOLLIN;
+    ev.data.fd = reactor.wakeFd;
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, reactor.wakeFd, &ev);
+
+    // 5. Timers fire on reactor 0 only
+    if (reactor.index == 0) {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFd < 0) {
+            perror("timerfd_create failed");
+            exit(1);
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = timerFd;
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+
+        // Timers added before run() need the fd armed now
+        std::lock_guard<std::mutex> lock(timerMutex);
+        armedDeadline = UINT64_MAX;
+        armTimerFd(timerWheel.nextDeadline());
+    }
+}
+
+void SocketServer::post(std::function<void()> task) {
+    Reactor& reactor = *reactors[0];
+    reactor.posted.push(std::move(task));
+    wakeReactor(reactor);
+}
+
+void SocketServer::post(int socket, std::function<void()> task) {
+    Reactor* reactor = reactors[0].get();
+    if (Connection* conn = getConnection(socket)) {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        if (conn->reactorIndex >= 0) reactor = reactors[conn->reactorIndex].get();
+    }
+    reactor->posted.push(std::move(task));
+    wakeReactor(*reactor);
+}
+
+void SocketServer::runPosted(Reactor& reactor) {
+    std::function<void()> task;
+    while (reactor.posted.pop(task)) task();
 }
 
 void SocketServer::run() {
-    setupServer();
+    for (auto& reactor : reactors) setupReactor(*reactor);
     running = true;
 
+    std::cout << "Server listening on port " << port << " (Epoll Mode, " << reactors.size() << " reactor"
+              << (reactors.size() > 1 ? "s" : "") << ")" << std::endl;
+
+    // Reactor 0 runs on the calling thread, the rest get their own
+    for (size_t i = 1; i < reactors.size(); ++i) {
+        Reactor* reactor = reactors[i].get();
+        reactor->thread = std::thread([this, reactor]() { runReactor(*reactor); });
+    }
+    runReactor(*reactors[0]);
+
+    running = false;
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) reactor->thread.join();
+    }
+}
+
+void SocketServer::runReactor(Reactor& reactor) {
     struct epoll_event events[MAX_EVENTS];
-    char buffer[BUFFER_SIZE];
+    currentReactor = &reactor;
+    runPosted(reactor); // Anything posted before run()
 
     while (running) {
-        // Wait for events (timeout 10ms to allow timer processing)
-        int nfds = epoll_wait(epollFd, events, MAX_EVENTS, 10);
+        // Sleep until I/O, a timer (timerfd) or a wakeup (eventfd)
+        int nfds = epoll_wait(reactor.epollFd, events, MAX_EVENTS, -1);
 
         if (nfds == -1) {
+            if (errno == EINTR) continue;
             perror("epoll_wait");
             break;
         }
 
         for (int i = 0; i < nfds; ++i) {
-            if (events[i].data.fd == serverFd) {
-                // New Connection
-                struct sockaddr_in clientAddr;
-                socklen_t clientLen = sizeof(clientAddr);
-                int clientFd = accept(serverFd, (struct sockaddr*)&clientAddr, &clientLen);
-                if (clientFd == -1) {
-                    perror("accept");
-                    continue;
-                }
-
-                setNonBlocking(clientFd);
+            if (events[i].data.fd == reactor.listenFd) {
+                // New Connection(s)
+                acceptConnections(reactor);
+            } else if (events[i].data.fd == reactor.wakeFd) {
+                uint64_t count;
+                while (read(reactor.wakeFd, &count, sizeof(count)) > 0) {}
+                runPosted(reactor);
+            } else if (events[i].data.fd == timerFd && reactor.index == 0) {
+                uint64_t expirations;
+                while (read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+                processTimers();
+            } else {
+                int clientFd = events[i].data.fd;
+                Connection* conn = getConnection(clientFd);
+                if (!conn) continue;
 
-                struct epoll_event ev;
-                ev.events = EPOLLIN; // Watch for Input
-                ev.data.fd = clientFd;
-                if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ev) == -1) {
-                    perror("epoll_ctl: clientFd");
-                    close(clientFd);
-                } else {
-                    if (onConnect) onConnect(clientFd);
-                }
+                // Socket drained enough to take more of the outbound buffer
+                if (events[i].events & EPOLLOUT) flushPending(clientFd, *conn);
 
-            } else {
                 // Client Data
-                int clientFd = events[i].data.fd;
-                int bytesRead = read(clientFd, buffer, BUFFER_SIZE);
-
-                if (bytesRead > 0) {
-                    if (onData) onData(clientFd, buffer, bytesRead);
-                } else {
-                    // Closed or Error
-                    if (onDisconnect) onDisconnect(clientFd);
-                    close(clientFd);
-                    epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    readConnection(reactor, clientFd, *conn);
                 }
             }
         }
-        
-        processTimers();
+
+        // Everything queued during this iteration goes out now, one syscall per connection
+        flushDirty(reactor);
     }
 }
 
-void SocketServer::processTimers() {
-    auto now = std::chrono::steady_clock::now();
-    for (auto& timer : timers) {
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - timer.lastRun).count();
-        if (elapsed >= timer.intervalMs) {
-            if (timer.callback) timer.callback();
-            timer.lastRun = now;
+void SocketServer::flushDirty(Reactor& reactor) {
+    {
+        std::lock_guard<std::mutex> lock(reactor.dirtyMutex);
+        if (reactor.dirty.empty()) return;
+        reactor.flushing.swap(reactor.dirty);
+    }
+    for (int fd : reactor.flushing) {
+        Connection* conn = getConnection(fd);
+        if (conn) flushPending(fd, *conn);
+    }
+    reactor.flushing.clear();
+}
+
+void SocketServer::markDirty(int socket, Reactor& reactor) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(reactor.dirtyMutex);
+        // An empty list means the owner may be asleep; otherwise a flush is already due
+        wake = reactor.dirty.empty() && currentReactor != &reactor;
+        reactor.dirty.push_back(socket);
+    }
+    if (wake) wakeReactor(reactor);
+}
+
+bool SocketServer::readConnection(Reactor& reactor, int clientFd, Connection& conn) {
+    RingBuffer& in = conn.inBuf;
+
+    while (true) {
+        char* ptr = nullptr;
+        size_t space = in.writableSpan(ptr);
+        if (space == 0) {
+            // Buffer is at its cap and the parser could not consume a single frame
+            std::cout << "Receive buffer overflow, disconnecting " << clientFd << std::endl;
+            handleDisconnect(reactor, clientFd);
+            return false;
+        }
+
+        ssize_t bytesRead = read(clientFd, ptr, space);
+        if (bytesRead > 0) {
+            in.commit((size_t)bytesRead);
+            if (onData) onData(clientFd, in);
+            // Level-triggered mode gets called again if more is waiting
+            if (!edgeTriggered) break;
+        } else if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        } else if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break; // Drained
+        } else {
+            // Closed or Error
+            handleDisconnect(reactor, clientFd);
+            return false;
         }
     }
+
+    // Idle until the next event: return any memory a burst made us grow
+    in.shrinkIfIdle();
+    return true;
+}
+
+uint32_t SocketServer::readEvents() const {
+    return edgeTriggered ? (EPOLLIN | EPOLLRDHUP | EPOLLET) : EPOLLIN;
+}
+
+void SocketServer::acceptConnections(Reactor& reactor) {
+    while (true) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int clientFd = accept(reactor.listenFd, (struct sockaddr*)&clientAddr, &clientLen);
+        if (clientFd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        setNonBlocking(clientFd);
+        if ((size_t)clientFd >= connections.size()) {
+            std::cerr << "Connection table full, rejecting fd " << clientFd << std::endl;
+            close(clientFd);
+            continue;
+        }
+        // Only the accepting reactor creates a slot (the kernel hands an fd to one
+        // accept at a time); other reactors may be reading the table concurrently
+        Connection* conn = connections[clientFd].load(std::memory_order_acquire);
+        if (!conn) {
+            conn = new Connection();
+            connections[clientFd].store(conn, std::memory_order_release);
+        }
+        resetConnection(*conn, reactor);
+
+        // Pin the connection to this reactor
+        struct epoll_event ev;
+        ev.events = readEvents(); // Watch for Input
+        ev.data.fd = clientFd;
+        if (epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, clientFd, &ev) == -1) {
+            perror("epoll_ctl: clientFd");
+            conn->open = false;
+            close(clientFd);
+        } else {
+            if (onConnect) onConnect(clientFd);
+        }
+    }
+}
+
+void SocketServer::resetConnection(Connection& conn, Reactor& reactor) {
+    std::lock_guard<std::mutex> lock(conn.writeMutex);
+    conn.open = true;
+    conn.generation++;
+    conn.reactorIndex = reactor.index;
+    conn.inBuf = RingBuffer(BUFFER_SIZE, MAX_INPUT_BUFFER);
+    clearOutput(conn);
+    conn.writeArmed = false;
+    conn.flushQueued = false;
+    conn.batchOutput = false;
+    // Session fields are reset by the owner in its connect callback
+}
+
+void SocketServer::handleDisconnect(Reactor& reactor, int clientFd) {
+    if (onDisconnect) onDisconnect(clientFd);
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+
+    // Close under the write lock so a concurrent sendData can't hit a reused fd
+    Connection* conn = getConnection(clientFd);
+    if (conn) {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->open = false;
+        conn->inBuf.reset();
+        conn->writeArmed = false;
+        clearOutput(*conn);
+        close(clientFd);
+    } else {
+        close(clientFd);
+    }
+}
+
+uint64_t SocketServer::timerNow() const {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - timerEpoch).count();
+}
+
+void SocketServer::processTimers() {
+    // Collect due callbacks first so a callback may add/remove timers
+    std::vector<TimerWheel::Callback> due;
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        timerWheel.advance(timerNow(), due);
+        armedDeadline = UINT64_MAX;
+        armTimerFd(timerWheel.nextDeadline());
+    }
+    for (auto& cb : due) {
+        if (cb) cb();
+    }
+}
+
+void SocketServer::armTimerFd(uint64_t deadline) {
+    if (timerFd < 0 || deadline >= armedDeadline) return;
+    armedDeadline = deadline;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline != UINT64_MAX) {
+        uint64_t now = timerNow();
+        uint64_t delayMs = deadline > now ? deadline - now : 0;
+        // A zero it_value disarms the timerfd, so "already due" becomes 1ns
+        uint64_t delayNs = delayMs > 0 ? delayMs * 1000000ull : 1;
+        spec.it_value.tv_sec = (time_t)(delayNs / 1000000000ull);
+        spec.it_value.tv_nsec = (long)(delayNs % 1000000000ull);
+    }
+    timerfd_settime(timerFd, 0, &spec, nullptr);
+}
+
+void SocketServer::wakeReactor(Reactor& reactor) {
+    if (reactor.wakeFd < 0) return;
+    uint64_t one = 1;
+    ssize_t ignored = write(reactor.wakeFd, &one, sizeof(one));
+    (void)ignored;
 }
 
 void SocketServer::stop() {
     running = false;
-    if (serverFd >= 0) close(serverFd);
-    if (epollFd >= 0) close(epollFd);
+    for (auto& reactor : reactors) wakeReactor(*reactor);
+}
+
+Connection* SocketServer::getConnection(int socket) {
+    if (socket < 0 || (size_t)socket >= connections.size()) return nullptr;
+    return connections[socket].load(std::memory_order_acquire);
+}
+
+Connection* SocketServer::getConnection(const ConnectionRef& ref) {
+    Connection* conn = getConnection(ref.fd);
+    if (!conn) return nullptr;
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    if (!conn->open || conn->generation != ref.generation) return nullptr;
+    return conn;
 }
 
 void SocketServer::sendData(int socket, const void* data, size_t size) {
-    // Send directly (Should handle EAGAIN in a real robust server, but blocking send is okay for simple logic)
-    send(socket, data, size, 0); 
+    if (size == 0) return;
+    // Raw bytes are copied once; shared messages are queued by reference
+    OutboundPtr msg = OutboundMessage::raw(data, size);
+    queueOutput(socket, &msg, 1);
+}
+
+void SocketServer::sendMessage(int socket, const OutboundPtr& msg) {
+    if (!msg || msg->size() == 0) return;
+    queueOutput(socket, &msg, 1);
+}
+
+void SocketServer::sendMessages(int socket, const std::vector<OutboundPtr>& msgs) {
+    queueOutput(socket, msgs.data(), msgs.size());
+}
+
+void SocketServer::queueOutput(int socket, const OutboundPtr* msgs, size_t count) {
+    Connection* conn = getConnection(socket);
+    if (!conn) return;
+
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) size += msgs[i] ? msgs[i]->size() : 0;
+    if (size == 0) return;
+
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    if (!conn->open || conn->reactorIndex < 0) return;
+
+    if (conn->outBytes + size > MAX_PENDING_OUTPUT) {
+        std::cerr << "Client " << socket << " is not reading, dropping connection" << std::endl;
+        clearOutput(*conn);
+        shutdown(socket, SHUT_RDWR);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (msgs[i] && msgs[i]->size() > 0) conn->outQueue.push_back(msgs[i]);
+    }
+    conn->outBytes += size;
+
+    // Nothing is written here: the owning reactor flushes at the end of its loop
+    // iteration (or on EPOLLOUT if the socket is already backed up)
+    if (!conn->flushQueued && !conn->writeArmed) {
+        conn->flushQueued = true;
+        markDirty(socket, *reactors[conn->reactorIndex]);
+    }
+}
+
+void SocketServer::flushPending(int socket, Connection& conn) {
+    std::lock_guard<std::mutex> lock(conn.writeMutex);
+    conn.flushQueued = false;
+    if (!conn.open) return;
+
+    while (!conn.outQueue.empty()) {
+        if (conn.batchOutput) sealBatch(conn);
+
+        ssize_t n;
+        const OutboundMessage& front = *conn.outQueue.front();
+        if (front.isFile()) {
+            // File region: the kernel copies straight from the page cache
+            off_t off = front.offset() + (off_t)conn.outOffset;
+            n = sendfile(socket, front.fd(), &off, front.size() - conn.outOffset);
+            if (n == 0) {
+                // File shorter than promised: the framing is broken, end the connection
+                std::cerr << "Short file while sending to " << socket << ", disconnecting" << std::endl;
+                clearOutput(conn);
+                setWriteInterest(socket, conn, false);
+                shutdown(socket, SHUT_RDWR);
+                return;
+            }
+        } else {
+            // Gather as many queued messages as fit into one call, up to the next file region
+            struct iovec iov[MAX_IOVECS];
+            int count = 0;
+            size_t offset = conn.outOffset;
+            for (auto it = conn.outQueue.begin(); it != conn.outQueue.end() && count < MAX_IOVECS && !(*it)->isFile(); ++it) {
+                iov[count].iov_base = (void*)((*it)->data() + offset);
+                iov[count].iov_len = (*it)->size() - offset;
+                offset = 0;
+                ++count;
+            }
+
+            struct msghdr hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_iov = iov;
+            hdr.msg_iovlen = count;
+            n = sendmsg(socket, &hdr, MSG_NOSIGNAL);
+        }
+        if (n > 0) {
+            size_t left = (size_t)n;
+            conn.outBytes -= left;
+            while (left > 0) {
+                size_t rest = conn.outQueue.front()->size() - conn.outOffset;
+                if (left < rest) {
+                    conn.outOffset += left;
+                    break;
+                }
+                left -= rest;
+                conn.outQueue.pop_front();
+                conn.outOffset = 0;
+                if (conn.outSealed > 0) conn.outSealed--;
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // Kernel buffer full: wait for EPOLLOUT
+                setWriteInterest(socket, conn, true);
+            } else {
+                // Broken connection: drop the output, the error surfaces on read
+                clearOutput(conn);
+                setWriteInterest(socket, conn, false);
+            }
+            return;
+        }
+    }
+
+    // Fully drained: stop watching for writability
+    setWriteInterest(socket, conn, false);
+}
+
+void SocketServer::clearOutput(Connection& conn) {
+    conn.outQueue.clear();
+    conn.outOffset = 0;
+    conn.outBytes = 0;
+    conn.outSealed = 0;
+}
+
+void SocketServer::sealBatch(Connection& conn) {
+    // Anything already partly written or inside an envelope goes out as it is
+    size_t first = std::max(conn.outSealed, conn.outOffset > 0 ? (size_t)1 : (size_t)0);
+    size_t last = first;
+    size_t body = 0;
+    int packets = 0;
+    while (last < conn.outQueue.size()) {
+        // A packet may span several entries (header + file region): all of it or none
+        size_t end = last + 1;
+        size_t unit = conn.outQueue[last]->size();
+        size_t owed = conn.outQueue[last]->trailingSize();
+        while (owed > 0 && end < conn.outQueue.size()) {
+            owed -= std::min(owed, conn.outQueue[end]->size());
+            unit += conn.outQueue[end]->size();
+            ++end;
+        }
+        // Leave room for the envelope so the whole batch fits one gather
+        if (owed > 0 || end - first > MAX_IOVECS - 1 || body + unit > MAX_BATCH_SIZE) break;
+        body += unit;
+        last = end;
+        ++packets;
+    }
+
+    if (packets >= 2) {
+        PacketHeader header;
+        memset(&header, 0, sizeof(header));
+        header.size = (uint32_t)body;
+        header.command = CMD_BATCH;
+        conn.outQueue.insert(conn.outQueue.begin() + first, OutboundMessage::raw(&header, sizeof(header)));
+        conn.outBytes += sizeof(header);
+        ++last;
+    }
+    conn.outSealed = last;
+}
+
+void SocketServer::setBatchOutput(int socket, bool enable) {
+    Connection* conn = getConnection(socket);
+    if (!conn) return;
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    conn->batchOutput = enable;
+}
+
+void SocketServer::setWriteInterest(int socket, Connection& conn, bool enable) {
+    if (conn.reactorIndex < 0 || conn.writeArmed == enable) return;
+    struct epoll_event ev;
+    ev.events = enable ? (readEvents() | EPOLLOUT) : readEvents();
+    ev.data.fd = socket;
+    epoll_ctl(reactors[conn.reactorIndex]->epollFd, EPOLL_CTL_MOD, socket, &ev);
+    conn.writeArmed = enable;
 }
 
 void SocketServer::closeSocket(int socket) {
-    if (epollFd >= 0) epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
-    close(socket);
+    // The socket may be pinned to another reactor. Shut it down instead of closing it
+    // so the owning reactor sees EOF and runs the normal disconnect path.
+    shutdown(socket, SHUT_RDWR);
+}
+
+TimerId SocketServer::addTimer(int intervalMs, std::function<void()> callback) {
+    return scheduleTimer(intervalMs, intervalMs, std::move(callback));
+}
+
+TimerId SocketServer::addOneShotTimer(int delayMs, std::function<void()> callback) {
+    return scheduleTimer(delayMs, 0, std::move(callback));
 }
 
-int SocketServer::addTimer(int intervalMs, std::function<void()> callback) {
-    Timer t;
-    t.id = nextTimerId++;
-    t.intervalMs = intervalMs;
-    t.callback = callback;
-    t.lastRun = std::chrono::steady_clock::now();
-    timers.push_back(t);
-    return t.id;
+TimerId SocketServer::scheduleTimer(int delayMs, int intervalMs, std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    // The wheel only moves when timers are processed; measure the delay from now
+    uint64_t now = timerNow();
+    uint64_t lag = now > timerWheel.now() ? now - timerWheel.now() : 0;
+    uint64_t delay = (uint64_t)std::max(delayMs, 0) + lag;
+    TimerId id = timerWheel.add(delay, (uint64_t)std::max(intervalMs, 0), std::move(callback));
+    armTimerFd(timerWheel.nextDeadline());
+    return id;
 }
 
-void SocketServer::removeTimer(int timerId) {
-    timers.erase(std::remove_if(timers.begin(), timers.end(), 
-        [timerId](const Timer& t){ return t.id == timerId; }), timers.end());
+void SocketServer::removeTimer(TimerId timerId) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    // The timerfd may fire early for a cancelled timer; processTimers re-arms it
+    timerWheel.cancel(timerId);
 }
 
 void SocketServer::setNonBlocking(int sock) {
@@ -3,7 +3,14 @@
 #include <string>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include <chrono> // For Timers
+#include "Connection.h"
+#include "TimerWheel.h"
+#include "MpscQueue.h"
 
 namespace Buckshot {
 
@@ -13,14 +20,26 @@ class GameSession;
 // Callback types
 // OnConnect(socket_fd)
 using ConnectCallback = std::function<void(int)>;
-// OnData(socket_fd, buffer, size)
-using DataCallback = std::function<void(int, const char*, size_t)>;
+// OnData(socket_fd, receive buffer)
+// The callback parses complete frames in place and consume()s them; anything it
+// leaves in the buffer is kept for the next read.
+using DataCallback = std::function<void(int, RingBuffer&)>;
 // OnDisconnect(socket_fd)
 using DisconnectCallback = std::function<void(int)>;
 
+// Threading model:
+// The server runs `reactorCount` reactors. Each reactor owns its own epoll fd and
+// its own SO_REUSEPORT listener on the same port, so the kernel spreads incoming
+// connections across them. A connection stays pinned to the reactor that accepted
+// it: all of its reads and its disconnect are handled on that reactor's thread.
+// Callbacks may therefore fire concurrently from different reactors; the owner of
+// the callbacks is responsible for guarding its shared state.
+// Reactor 0 runs on the thread that calls run() and is the only one that fires timers.
+// Timers live in a hierarchical wheel behind a single timerfd in reactor 0's epoll set,
+// so an idle server sleeps in epoll_wait until the next timer is actually due.
 class SocketServer {
 public:
-    SocketServer(int port);
+    SocketServer(int port, int reactorCount = 1);
     ~SocketServer();
 
     void run();
@@ -32,37 +51,104 @@ public:
     void setDisconnectCallback(DisconnectCallback cb) { onDisconnect = cb; }
 
     // Timer (to replace asio::steady_timer)
-    // Returns a timer ID
-    int addTimer(int intervalMs, std::function<void()> callback);
-    void removeTimer(int timerId);
+    // Returns a timer ID. Adding and removing are O(1) and safe from any reactor.
+    TimerId addTimer(int intervalMs, std::function<void()> callback);
+    TimerId addOneShotTimer(int delayMs, std::function<void()> callback);
+    void removeTimer(TimerId timerId);
 
-    // Helpers
+    // Runs task on reactor 0's thread, as soon as it is next awake. Safe from any thread;
+    // the task goes on a lock-free queue and the reactor's eventfd wakes it up.
+    // This is how background work hands results back to the event loop.
+    void post(std::function<void()> task);
+    // Same, on the reactor that owns `socket` (reactor 0 if it was never a client),
+    // for work that touches the session half of that connection
+    void post(int socket, std::function<void()> task);
+
+    // Helpers (safe to call from any reactor)
+    // Sends never block and never write directly: data is queued on the connection and
+    // the owning reactor writes everything queued for it in one sendmsg() at the end of
+    // its loop iteration. Sends from another thread wake the owner to do so.
     void sendData(int socket, const void* data, size_t size);
+    // Same, for a pre-encoded message. Only the reference is queued, so sending one
+    // message to many sockets costs a single encode.
+    void sendMessage(int socket, const OutboundPtr& msg);
+    // Several messages queued back to back, with nothing from other threads in between
+    void sendMessages(int socket, const std::vector<OutboundPtr>& msgs);
     void closeSocket(int socket);
+    // From now on, messages queued together go out in CMD_BATCH envelopes
+    void setBatchOutput(int socket, bool enable);
+
+    int getReactorCount() const { return (int)reactors.size(); }
+
+    // Record for an fd, or nullptr if the fd was never a client.
+    // The session half of the record belongs to the callback owner.
+    Connection* getConnection(int socket);
+    // Resolves a ConnectionRef to its fd only if that connection is still the same one
+    Connection* getConnection(const ConnectionRef& ref);
+
+    // Edge-triggered (default): every readiness event drains the socket until EAGAIN.
+    // Level-triggered: one read per event. Must be chosen before run().
+    void setEdgeTriggered(bool enable) { edgeTriggered = enable; }
 
 private:
     int port;
-    bool running;
-    int serverFd;
-    int epollFd;
+    std::atomic<bool> running;
+    bool edgeTriggered = true;
 
     ConnectCallback onConnect;
     DataCallback onData;
     DisconnectCallback onDisconnect;
 
-    // Timer Structure
-    struct Timer {
-        int id;
-        int intervalMs;
-        std::chrono::steady_clock::time_point lastRun;
-        std::function<void()> callback;
+    // One event loop per thread
+    struct Reactor {
+        int index = 0;
+        int listenFd = -1;
+        int epollFd = -1;
+        int wakeFd = -1; // eventfd used to break out of epoll_wait
+        MpscQueue<std::function<void()>> posted; // Tasks from post(), run by the owner
+        std::thread thread;
+        // Sockets with output queued since the last flush (any thread may add)
+        std::mutex dirtyMutex;
+        std::vector<int> dirty;
+        std::vector<int> flushing; // Owner-only scratch, swapped with dirty
     };
-    std::vector<Timer> timers;
-    int nextTimerId = 1;
+    std::vector<std::unique_ptr<Reactor>> reactors;
 
-    void setupServer();
+    // Per-connection records, indexed by fd. Slots are allocated on first accept of an fd,
+    // published with a release store and reused afterwards (freed in the destructor);
+    // the table itself never resizes so any reactor may index it.
+    std::vector<std::atomic<Connection*>> connections;
+
+    // Timer Structure
+    TimerWheel timerWheel;
+    std::mutex timerMutex;
+    int timerFd = -1;
+    uint64_t armedDeadline = UINT64_MAX; // Wheel tick the timerfd is set for
+    std::chrono::steady_clock::time_point timerEpoch;
+
+    uint64_t timerNow() const;
+    TimerId scheduleTimer(int delayMs, int intervalMs, std::function<void()> callback);
+    void armTimerFd(uint64_t deadline); // Requires timerMutex
+
+    void setupReactor(Reactor& reactor);
+    void runReactor(Reactor& reactor);
+    void acceptConnections(Reactor& reactor);
+    void handleDisconnect(Reactor& reactor, int clientFd);
+    // Returns false if the connection was closed
+    bool readConnection(Reactor& reactor, int clientFd, Connection& conn);
+    uint32_t readEvents() const;
+    void queueOutput(int socket, const OutboundPtr* msgs, size_t count);
+    void flushPending(int socket, Connection& conn);
+    void flushDirty(Reactor& reactor);
+    void markDirty(int socket, Reactor& reactor); // Requires the connection's writeMutex
+    void clearOutput(Connection& conn); // Requires conn.writeMutex
+    void sealBatch(Connection& conn);   // Requires conn.writeMutex
+    void setWriteInterest(int socket, Connection& conn, bool enable);
+    void resetConnection(Connection& conn, Reactor& reactor);
     void processTimers();
-    
+    void runPosted(Reactor& reactor);
+    void wakeReactor(Reactor& reactor);
+
     // Non-blocking helper
     void setNonBlocking(int sock);
 };
@@ -0,0 +1,161 @@
+#include "TimerWheel.h"
+#include <limits>
+
+namespace Buckshot {
+
+static inline uint64_t rotateRight(uint64_t v, unsigned n) {
+    n &= 63;
+    return n == 0 ? v : (v >> n) | (v << (64 - n));
+}
+
+TimerWheel::TimerWheel() {
+    for (int l = 0; l < LEVELS; ++l) {
+        for (int s = 0; s < SLOTS; ++s) heads[l][s] = NIL;
+    }
+}
+
+TimerId TimerWheel::add(uint64_t delayMs, uint64_t intervalMs, Callback callback) {
+    int32_t index;
+    if (!freeList.empty()) {
+        index = freeList.back();
+        freeList.pop_back();
+    } else {
+        index = (int32_t)nodes.size();
+        nodes.emplace_back();
+    }
+
+    Node& node = nodes[index];
+    node.expiry = current + (delayMs == 0 ? 1 : delayMs);
+    node.interval = intervalMs;
+    node.callback = std::move(callback);
+    link(index);
+    activeCount++;
+
+    return ((TimerId)node.generation << 32) | (uint32_t)index;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    uint32_t index = (uint32_t)(id & 0xFFFFFFFFu);
+    uint32_t generation = (uint32_t)(id >> 32);
+    if (index >= nodes.size()) return false;
+
+    Node& node = nodes[index];
+    if (node.generation != generation || node.level < 0) return false;
+
+    unlink((int32_t)index);
+    release((int32_t)index);
+    return true;
+}
+
+void TimerWheel::link(int32_t index) {
+    Node& node = nodes[index];
+
+    // Pick the lowest level whose span still reaches the expiry
+    uint64_t maxSpan = (uint64_t)1 << (SLOT_BITS * LEVELS);
+    uint64_t expiry = node.expiry;
+    if (expiry < current) expiry = current;
+    if (expiry - current >= maxSpan) expiry = current + maxSpan - 1; // Re-filed on cascade
+
+    uint64_t delta = expiry - current;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) level++;
+    int slot = (int)((expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+
+    node.level = (int16_t)level;
+    node.slot = (int16_t)slot;
+    node.prev = NIL;
+    node.next = heads[level][slot];
+    if (node.next != NIL) nodes[node.next].prev = index;
+    heads[level][slot] = index;
+    occupied[level] |= (uint64_t)1 << slot;
+}
+
+void TimerWheel::unlink(int32_t index) {
+    Node& node = nodes[index];
+    if (node.prev != NIL) nodes[node.prev].next = node.next;
+    else heads[node.level][node.slot] = node.next;
+    if (node.next != NIL) nodes[node.next].prev = node.prev;
+    if (heads[node.level][node.slot] == NIL) occupied[node.level] &= ~((uint64_t)1 << node.slot);
+    node.prev = node.next = NIL;
+    node.level = -1;
+}
+
+void TimerWheel::release(int32_t index) {
+    Node& node = nodes[index];
+    node.callback = nullptr;
+    node.generation++;
+    if (node.generation == 0) node.generation = 1; // Keep ids non-zero
+    freeList.push_back(index);
+    activeCount--;
+}
+
+void TimerWheel::cascade(int level) {
+    int slot = (int)((current >> (SLOT_BITS * level)) & (SLOTS - 1));
+    int32_t index = heads[level][slot];
+    heads[level][slot] = NIL;
+    occupied[level] &= ~((uint64_t)1 << slot);
+
+    // Re-file everything relative to the new position; due ones land in the current slot
+    while (index != NIL) {
+        int32_t next = nodes[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+void TimerWheel::expireCurrent(std::vector<Callback>& expired) {
+    int slot = (int)(current & (SLOTS - 1));
+    int32_t index = heads[0][slot];
+    while (index != NIL) {
+        int32_t next = nodes[index].next;
+        Node& node = nodes[index];
+        unlink(index);
+        if (node.interval > 0) {
+            expired.push_back(node.callback);
+            node.expiry = current + node.interval;
+            link(index);
+        } else {
+            expired.push_back(std::move(node.callback));
+            release(index);
+        }
+        index = next;
+    }
+}
+
+uint64_t TimerWheel::nextDeadline() const {
+    uint64_t best = std::numeric_limits<uint64_t>::max();
+    for (int level = 0; level < LEVELS; ++level) {
+        if (!occupied[level]) continue;
+        int shift = SLOT_BITS * level;
+        uint64_t window = current >> shift;
+        unsigned pos = (unsigned)(window & (SLOTS - 1));
+
+        // Distance (1..64) to the nearest occupied slot ahead of the current one
+        uint64_t rotated = rotateRight(occupied[level], pos + 1);
+        uint64_t distance = (uint64_t)__builtin_ctzll(rotated) + 1;
+        uint64_t tick = (window + distance) << shift;
+        if (tick < best) best = tick;
+    }
+    return best;
+}
+
+void TimerWheel::advance(uint64_t nowMs, std::vector<Callback>& expired) {
+    while (current < nowMs) {
+        // Skip straight over empty stretches
+        uint64_t next = nextDeadline();
+        if (next > nowMs) {
+            current = nowMs;
+            break;
+        }
+        current = next;
+
+        // Cascade higher levels whose window starts here, top-down
+        for (int level = LEVELS - 1; level > 0; --level) {
+            uint64_t mask = ((uint64_t)1 << (SLOT_BITS * level)) - 1;
+            if ((current & mask) == 0) cascade(level);
+        }
+        expireCurrent(expired);
+    }
+}
+
+}
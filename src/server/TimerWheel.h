@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Buckshot {
+
+// Opaque handle: slot index in the low 32 bits, slot generation in the high 32
+using TimerId = uint64_t;
+constexpr TimerId INVALID_TIMER = 0;
+
+// Hierarchical timing wheel with 1ms ticks.
+// Four levels of 64 slots each cover ~4.6 hours; longer timers are parked in the
+// top level and re-filed when it cascades. Timers are intrusive list nodes in a slab,
+// so add() and cancel() are O(1), and each level keeps an occupancy bitmap so the
+// next tick that needs work is found in O(levels) instead of ticking every slot.
+// Not thread-safe: the owner serialises access.
+class TimerWheel {
+public:
+    using Callback = std::function<void()>;
+
+    TimerWheel();
+
+    // intervalMs == 0 makes a one-shot timer
+    TimerId add(uint64_t delayMs, uint64_t intervalMs, Callback callback);
+    bool cancel(TimerId id);
+
+    // Moves the wheel forward to nowMs and appends every callback that came due.
+    // Periodic timers are re-armed before they are handed out.
+    void advance(uint64_t nowMs, std::vector<Callback>& expired);
+
+    // Earliest tick at which advance() has work to do (an expiry or a cascade),
+    // or UINT64_MAX if the wheel is empty
+    uint64_t nextDeadline() const;
+
+    uint64_t now() const { return current; }
+    size_t size() const { return activeCount; }
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr int32_t NIL = -1;
+
+    struct Node {
+        uint64_t expiry = 0;
+        uint64_t interval = 0;
+        Callback callback;
+        int32_t prev = NIL;
+        int32_t next = NIL;
+        uint32_t generation = 1;
+        int16_t level = -1; // -1 when not linked into a slot
+        int16_t slot = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int32_t> freeList;
+    int32_t heads[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS] = {};
+    uint64_t current = 0;
+    size_t activeCount = 0;
+
+    void link(int32_t index);
+    void unlink(int32_t index);
+    void release(int32_t index);
+    void cascade(int level);
+    void expireCurrent(std::vector<Callback>& expired);
+};
+
+}
@@ -0,0 +1,91 @@
+#include "UserCache.h"
+
+namespace Buckshot {
+
+UserCache::UserCache(size_t offlineCapacity) : offlineCapacity(offlineCapacity) {}
+
+std::optional<User> UserCache::get(const std::string& username) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(username);
+    if (it == entries.end()) return std::nullopt;
+    touch(it->second);
+    return it->second.user;
+}
+
+void UserCache::insert(const User& user, uint64_t seenWrites) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // A cached record may already hold a newer write than this read saw
+    if (writes != seenWrites || entries.count(user.username)) return;
+    add(user);
+}
+
+uint64_t UserCache::writeCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writes;
+}
+
+void UserCache::put(const User& user) {
+    std::lock_guard<std::mutex> lock(mutex);
+    writes++;
+    auto it = entries.find(user.username);
+    if (it == entries.end()) {
+        add(user);
+        return;
+    }
+    it->second.user = user;
+    touch(it->second);
+}
+
+void UserCache::erase(const std::string& username) {
+    std::lock_guard<std::mutex> lock(mutex);
+    writes++;
+    auto it = entries.find(username);
+    if (it == entries.end()) return;
+    if (it->second.inLru) lru.erase(it->second.lruPos);
+    entries.erase(it);
+}
+
+void UserCache::setOnline(const std::string& username, bool isOnline) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(username);
+    if (isOnline) {
+        online.insert(username);
+        if (it != entries.end() && it->second.inLru) {
+            lru.erase(it->second.lruPos);
+            it->second.inLru = false;
+        }
+    } else {
+        online.erase(username);
+        if (it != entries.end() && !it->second.inLru) {
+            lru.push_front(username);
+            it->second.lruPos = lru.begin();
+            it->second.inLru = true;
+            evict();
+        }
+    }
+}
+
+void UserCache::touch(Entry& entry) {
+    if (!entry.inLru) return;
+    lru.splice(lru.begin(), lru, entry.lruPos);
+}
+
+void UserCache::add(const User& user) {
+    Entry& entry = entries[user.username];
+    entry.user = user;
+    if (!online.count(user.username)) {
+        lru.push_front(user.username);
+        entry.lruPos = lru.begin();
+        entry.inLru = true;
+        evict();
+    }
+}
+
+void UserCache::evict() {
+    while (lru.size() > offlineCapacity) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Buckshot {
+
+struct User {
+    std::string username;
+    std::string password;
+    int wins = 0;
+    int losses = 0;
+    int elo = 1000;
+};
+
+// In-memory User records in front of the database, keyed by username.
+// Online users are pinned; offline users sit in an LRU list capped at
+// offlineCapacity, and the least recently used one is dropped past that.
+// UserManager keeps it write-through: every committed write to a users row
+// put()s the new record, so a hit is never older than the database. Thread-safe.
+class UserCache {
+public:
+    explicit UserCache(size_t offlineCapacity);
+
+    std::optional<User> get(const std::string& username); // Counts as a use
+    // Loaded from the database: never replaces a cached record, and is dropped if
+    // anything was written since writeCount() returned seenWrites (the read may
+    // predate that write, whose own entry may already have been evicted)
+    void insert(const User& user, uint64_t seenWrites);
+    uint64_t writeCount();
+    void put(const User& user);    // Written to the database: adds or replaces
+    void erase(const std::string& username); // Next get() misses and reads the database
+
+    // Online users are never evicted
+    void setOnline(const std::string& username, bool online);
+
+private:
+    struct Entry {
+        User user;
+        bool inLru = false;
+        std::list<std::string>::iterator lruPos;
+    };
+
+    size_t offlineCapacity;
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_set<std::string> online;
+    std::list<std::string> lru; // Offline entries, most recently used first
+    uint64_t writes = 0;        // put()s and erase()s so far
+
+    void touch(Entry& entry);          // Requires mutex
+    void add(const User& user);        // Requires mutex; the name must not be cached yet
+    void evict();                      // Requires mutex
+};
+
+}
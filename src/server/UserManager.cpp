@@ -3,32 +3,107 @@
 #include <fstream>
 #include <sstream>
 #include <cmath>
-#include <cmath>
 #include <algorithm>
 #include <cstring>
+#include <chrono>
+#include <memory>
 
 namespace Buckshot {
 
-UserManager::UserManager() {
+namespace {
+
+// Every query UserManager runs, indexed by UserManager::StatementId
+const char* const STATEMENT_SQL[] = {
+    "BEGIN TRANSACTION;",
+    "COMMIT;",
+    "ROLLBACK;",
+    "INSERT INTO users (username, password, wins, losses, elo) VALUES (?, ?, 0, 0, 1000);",
+    "SELECT username, password, wins, losses, elo FROM users WHERE username = ?;",
+    "UPDATE users SET wins = ?, losses = ?, elo = ? WHERE username = ?;",
+    "INSERT INTO match_history (winner, loser, winner_elo_change, loser_elo_change, replay_file) VALUES (?, ?, ?, ?, ?);",
+    "SELECT timestamp, winner, loser, winner_elo_change, loser_elo_change, replay_file FROM match_history WHERE winner = ? OR loser = ? ORDER BY id DESC LIMIT 20;",
+    "SELECT username, elo, wins, losses FROM users ORDER BY elo DESC LIMIT 10;",
+    "SELECT status FROM friends WHERE (requester=? AND target=?) OR (requester=? AND target=?);",
+    "INSERT INTO friends (requester, target, status) VALUES (?, ?, 'PENDING');",
+    "UPDATE friends SET status='ACCEPTED' WHERE requester=? AND target=? AND status='PENDING';",
+    "DELETE FROM friends WHERE (requester=? AND target=?) OR (requester=? AND target=?);",
+    "SELECT requester, target, status FROM friends WHERE requester=? OR target=?;",
+};
+static_assert(sizeof(STATEMENT_SQL) / sizeof(STATEMENT_SQL[0]) == UserManager::STMT_COUNT,
+              "one SQL string per StatementId");
+
+// Hands out a cached statement and resets it (bindings included) when the scope ends,
+// so it never holds a read lock or a dangling bound string between calls
+class ScopedStatement {
+public:
+    explicit ScopedStatement(sqlite3_stmt* stmt) : stmt(stmt) {}
+    ~ScopedStatement() {
+        if (!stmt) return;
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+    ScopedStatement(const ScopedStatement&) = delete;
+    ScopedStatement& operator=(const ScopedStatement&) = delete;
+    explicit operator bool() const { return stmt != nullptr; }
+    operator sqlite3_stmt*() const { return stmt; }
+
+private:
+    sqlite3_stmt* stmt;
+};
+
+}
+
+UserManager::UserManager(const DatabaseOptions& options) : options(options), cache(options.userCacheSize) {
     initDatabase();
+    writerThread = std::thread([this]() { runWriter(); });
     // Auto-migrate if users.txt exists
     migrateFromFlatFile("users.txt");
 }
 
 UserManager::~UserManager() {
-    if (db) {
-        sqlite3_close(db);
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        stopping = true;
     }
+    writeReady.notify_one();
+    if (writerThread.joinable()) writerThread.join();
+    closeConnection(reader);
+    closeConnection(writer);
 }
 
-void UserManager::initDatabase() {
-    int rc = sqlite3_open("buckshot.db", &db);
+bool UserManager::openConnection(DbConnection& conn) {
+    int rc = sqlite3_open(options.path.c_str(), &conn.db);
     if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
-        return;
+        std::cerr << "Can't open database: " << sqlite3_errmsg(conn.db) << std::endl;
+        sqlite3_close(conn.db);
+        conn.db = nullptr;
+        return false;
     }
+    // The writer holds its lock only for a commit; readers never block it in WAL mode
+    sqlite3_busy_timeout(conn.db, 1000);
+    return true;
+}
+
+void UserManager::closeConnection(DbConnection& conn) {
+    for (sqlite3_stmt*& stmt : conn.statements) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+    if (conn.db) {
+        sqlite3_close(conn.db);
+        conn.db = nullptr;
+    }
+}
+
+void UserManager::initDatabase() {
+    if (!openConnection(writer)) return;
 
-// ... (previous code)
+    // WAL lets the reader connection run alongside the writer's open batch
+    sqlite3_exec(writer.db, "PRAGMA journal_mode=WAL;", 0, 0, 0);
+    const char* sync = options.durability == DURABILITY_FULL ? "PRAGMA synchronous=FULL;"
+                     : options.durability == DURABILITY_OFF ? "PRAGMA synchronous=OFF;"
+                     : "PRAGMA synchronous=NORMAL;";
+    sqlite3_exec(writer.db, sync, 0, 0, 0);
 
     const char* sql = "CREATE TABLE IF NOT EXISTS users ("
                       "username TEXT PRIMARY KEY,"
@@ -52,7 +127,7 @@ void UserManager::initDatabase() {
                       "UNIQUE(requester, target));";
 
     char* errMsg = 0;
-    rc = sqlite3_exec(db, sql, 0, 0, &errMsg);
+    int rc = sqlite3_exec(writer.db, sql, 0, 0, &errMsg);
     if (rc != SQLITE_OK) {
         std::cerr << "SQL error: " << errMsg << std::endl;
         sqlite3_free(errMsg);
@@ -61,86 +136,143 @@ void UserManager::initDatabase() {
     // Auto-migration for replay_file if it doesn't exist
     // Simple way: Try to add it, ignore error
     char* altMsg = 0;
-    sqlite3_exec(db, "ALTER TABLE match_history ADD COLUMN replay_file TEXT;", 0, 0, &altMsg);
+    sqlite3_exec(writer.db, "ALTER TABLE match_history ADD COLUMN replay_file TEXT;", 0, 0, &altMsg);
     if (altMsg) sqlite3_free(altMsg);
     
     // Auto-migration for elo changes
-    sqlite3_exec(db, "ALTER TABLE match_history ADD COLUMN winner_elo_change INTEGER DEFAULT 0;", 0, 0, 0);
-    sqlite3_exec(db, "ALTER TABLE match_history ADD COLUMN loser_elo_change INTEGER DEFAULT 0;", 0, 0, 0);
-}
-
-
-void UserManager::migrateFromFlatFile(const std::string& filepath) {
-    std::ifstream file(filepath);
-    if (!file.is_open()) return;
-
-    std::string line;
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        std::stringstream ss(line);
-        std::string user, pass;
-        int w, l, e;
-        if (ss >> user >> pass >> w >> l >> e) {
-            // Check if exists
-            auto existing = getUser(user);
-            if (!existing) {
-                 registerUser(user, pass);
-                 // Update stats
-                 std::string sql = "UPDATE users SET wins = ?, losses = ?, elo = ? WHERE username = ?;";
-                 sqlite3_stmt* stmt;
-                 if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
-                     sqlite3_bind_int(stmt, 1, w);
-                     sqlite3_bind_int(stmt, 2, l);
-                     sqlite3_bind_int(stmt, 3, e);
-                     sqlite3_bind_text(stmt, 4, user.c_str(), -1, SQLITE_STATIC);
-                     sqlite3_step(stmt);
-                     sqlite3_finalize(stmt);
-                 }
+    sqlite3_exec(writer.db, "ALTER TABLE match_history ADD COLUMN winner_elo_change INTEGER DEFAULT 0;", 0, 0, 0);
+    sqlite3_exec(writer.db, "ALTER TABLE match_history ADD COLUMN loser_elo_change INTEGER DEFAULT 0;", 0, 0, 0);
+
+    // Statements are compiled once against the final schema, on both connections
+    if (!openConnection(reader)) return;
+    for (DbConnection* conn : {&writer, &reader}) {
+        for (int i = 0; i < STMT_COUNT; ++i) {
+            if (sqlite3_prepare_v3(conn->db, STATEMENT_SQL[i], -1, SQLITE_PREPARE_PERSISTENT, &conn->statements[i], nullptr) != SQLITE_OK) {
+                std::cerr << "Can't prepare statement " << i << ": " << sqlite3_errmsg(conn->db) << std::endl;
+                conn->statements[i] = nullptr;
             }
         }
     }
-    file.close();
-    // Rename/Delete to prevent re-migration? Or just leave it. getUser check prevents dupes.
 }
 
-bool UserManager::registerUser(const std::string& username, const std::string& password) {
-    if (getUser(username)) return false; // Already exists
+void UserManager::enqueue(WriteJob job) {
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        writeQueue.push_back(std::move(job));
+    }
+    writeReady.notify_one();
+}
 
-    std::string sql = "INSERT INTO users (username, password, wins, losses, elo) VALUES (?, ?, 0, 0, 1000);";
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
-    if (rc != SQLITE_OK) return false;
+bool UserManager::write(std::function<void(DbConnection&)> apply, bool waitForCommit) {
+    std::promise<bool> done;
+    std::future<bool> finished = done.get_future();
+    enqueue(WriteJob{std::move(apply), [&done](bool ok) { done.set_value(ok); }, waitForCommit});
+    return finished.get();
+}
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, password.c_str(), -1, SQLITE_STATIC);
+void UserManager::writeAsync(std::function<void(DbConnection&)> apply, std::function<void(bool)> onCommitted) {
+    bool waitForCommit = onCommitted != nullptr;
+    enqueue(WriteJob{std::move(apply), std::move(onCommitted), waitForCommit});
+}
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    return (rc == SQLITE_DONE);
+bool UserManager::step(DbConnection& conn, StatementId id) {
+    ScopedStatement stmt(conn.statements[id]);
+    return stmt && sqlite3_step(stmt) == SQLITE_DONE;
 }
 
-bool UserManager::loginUser(const std::string& username, const std::string& password) {
-    std::string sql = "SELECT password FROM users WHERE username = ?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return false;
+void UserManager::runWriter() {
+    std::unique_lock<std::mutex> lock(writeMutex);
+    while (true) {
+        writeReady.wait(lock, [this]() { return stopping || !writeQueue.empty(); });
+        if (writeQueue.empty()) return; // Stopping, and everything is committed
+
+        // Open a batch: writes arriving within the commit window join it
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.commitWindowMs);
+        std::vector<std::function<void(bool)>> waitingForCommit;
+        int applied = 0;
+        bool commitNow = false;
+        if (!step(writer, STMT_BEGIN)) {
+            // Outside a transaction every statement would commit on its own, with
+            // no way to report it; fail one batch's worth and try again after
+            std::cerr << "Can't open group commit: " << sqlite3_errmsg(writer.db) << std::endl;
+            std::vector<WriteJob> failed;
+            while (!writeQueue.empty() && (int)failed.size() < options.maxBatch) {
+                failed.push_back(std::move(writeQueue.front()));
+                writeQueue.pop_front();
+            }
+            lock.unlock();
+            for (WriteJob& job : failed) {
+                if (job.done) job.done(false);
+            }
+            lock.lock();
+            continue;
+        }
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    
-    bool valid = false;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* dbPass = (const char*)sqlite3_column_text(stmt, 0);
-        if (dbPass && password == std::string(dbPass)) {
-            valid = true;
+        while (true) {
+            while (!writeQueue.empty() && applied < options.maxBatch) {
+                WriteJob job = std::move(writeQueue.front());
+                writeQueue.pop_front();
+                lock.unlock();
+                job.apply(writer);
+                if (!job.waitForCommit && job.done) job.done(true);
+                lock.lock();
+                applied++;
+                if (job.waitForCommit) {
+                    waitingForCommit.push_back(std::move(job.done));
+                    commitNow = true;
+                }
+            }
+            if (commitNow || stopping || applied >= options.maxBatch) break;
+            if (!writeReady.wait_until(lock, deadline, [this]() { return stopping || !writeQueue.empty(); })) break;
         }
+
+        lock.unlock();
+        bool committed = step(writer, STMT_COMMIT);
+        if (!committed) {
+            std::cerr << "Group commit failed: " << sqlite3_errmsg(writer.db) << std::endl;
+            // Left open, the transaction would swallow every later batch. Some
+            // errors have already rolled it back, which leaves autocommit on.
+            if (!sqlite3_get_autocommit(writer.db)) step(writer, STMT_ROLLBACK);
+        }
+        for (const User& user : uncommittedUsers) {
+            if (committed) cache.put(user);
+            else cache.erase(user.username); // Rolled back: the next read goes to the database
+        }
+        uncommittedUsers.clear();
+        for (auto& done : waitingForCommit) done(committed);
+        lock.lock();
     }
-    sqlite3_finalize(stmt);
-    return valid;
 }
 
-std::optional<User> UserManager::getUser(const std::string& username) {
-    std::string sql = "SELECT username, password, wins, losses, elo FROM users WHERE username = ?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return std::nullopt;
+void UserManager::migrateFromFlatFile(const std::string& filepath) {
+    std::ifstream file(filepath);
+    if (!file.is_open()) return;
+
+    // One transaction for the whole file
+    bool committed = write([&](DbConnection& conn) {
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) continue;
+            std::stringstream ss(line);
+            std::string user, pass;
+            int w, l, e;
+            if (ss >> user >> pass >> w >> l >> e) {
+                // Check if exists
+                if (!findUser(conn, user) && insertUser(conn, user, pass)) {
+                    updateStats(conn, user, w, l, e);
+                    uncommittedUsers.push_back(User{user, pass, w, l, e});
+                }
+            }
+        }
+    }, true);
+    file.close();
+    if (!committed) std::cerr << "Migration from " << filepath << " was not committed" << std::endl;
+    // Rename/Delete to prevent re-migration? Or just leave it. findUser check prevents dupes.
+}
+
+std::optional<User> UserManager::findUser(DbConnection& conn, const std::string& username) {
+    ScopedStatement stmt(conn.statements[STMT_GET_USER]);
+    if (!stmt) return std::nullopt;
 
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
 
@@ -154,92 +286,127 @@ std::optional<User> UserManager::getUser(const std::string& username) {
         u.elo = sqlite3_column_int(stmt, 4);
         result = u;
     }
-    sqlite3_finalize(stmt);
     return result;
 }
 
-std::pair<int, int> UserManager::recordMatch(const std::string& winnerName, const std::string& loserName, const std::string& replayFile) {
-    auto winnerOpt = getUser(winnerName);
-    auto loserOpt = getUser(loserName);
-
-    // Create dummy users if not found (e.g. AI)
-    User winner = winnerOpt.value_or(User{winnerName, "", 0, 0, 1000});
-    User loser = loserOpt.value_or(User{loserName, "", 0, 0, 1000});
-
-    // Elo Config
-    double Ra = (double)winner.elo;
-    double Rb = (double)loser.elo;
-    double Ea = 1.0 / (1.0 + pow(10.0, (Rb - Ra) / 400.0));
-    double Eb = 1.0 / (1.0 + pow(10.0, (Ra - Rb) / 400.0));
-    int K = 32;
-    int winnerDelta = (int)(K * (1.0 - Ea));
-    int loserDelta = (int)(K * (0.0 - Eb));
-
-    winner.elo += winnerDelta;
-    loser.elo += loserDelta;
-    winner.wins++;
-    loser.losses++;
-
-    // Transactional Update
-    char* errMsg = 0;
-    sqlite3_exec(db, "BEGIN TRANSACTION;", 0, 0, &errMsg);
-
-    std::string updateSql = "UPDATE users SET wins = ?, losses = ?, elo = ? WHERE username = ?;";
-    
-    // Update Winner if they exist
-    if (winnerOpt) {
-        sqlite3_stmt* stmtW;
-        sqlite3_prepare_v2(db, updateSql.c_str(), -1, &stmtW, 0);
-        sqlite3_bind_int(stmtW, 1, winner.wins);
-        sqlite3_bind_int(stmtW, 2, winner.losses);
-        sqlite3_bind_int(stmtW, 3, winner.elo);
-        sqlite3_bind_text(stmtW, 4, winner.username.c_str(), -1, SQLITE_STATIC);
-        sqlite3_step(stmtW);
-        sqlite3_finalize(stmtW);
-    }
+bool UserManager::insertUser(DbConnection& conn, const std::string& username, const std::string& password) {
+    ScopedStatement stmt(conn.statements[STMT_INSERT_USER]);
+    if (!stmt) return false;
 
-    // Update Loser if they exist
-    if (loserOpt) {
-        sqlite3_stmt* stmtL;
-        sqlite3_prepare_v2(db, updateSql.c_str(), -1, &stmtL, 0);
-        sqlite3_bind_int(stmtL, 1, loser.wins);
-        sqlite3_bind_int(stmtL, 2, loser.losses);
-        sqlite3_bind_int(stmtL, 3, loser.elo);
-        sqlite3_bind_text(stmtL, 4, loser.username.c_str(), -1, SQLITE_STATIC);
-        sqlite3_step(stmtL);
-        sqlite3_finalize(stmtL);
-    }
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, password.c_str(), -1, SQLITE_STATIC);
 
-    sqlite3_exec(db, "COMMIT;", 0, 0, &errMsg);
+    return (sqlite3_step(stmt) == SQLITE_DONE);
+}
 
-    logMatch(winnerName, loserName, winnerDelta, loserDelta, replayFile);
-    
-    std::cout << "Match Recorded (DB): " << winnerName << " (+" << winnerDelta << ") vs " << loserName << " (" << loserDelta << ")" << std::endl;
-    
-    return {winnerDelta, loserDelta};
+void UserManager::updateStats(DbConnection& conn, const std::string& username, int wins, int losses, int elo) {
+    ScopedStatement stmt(conn.statements[STMT_UPDATE_STATS]);
+    if (!stmt) return;
+    sqlite3_bind_int(stmt, 1, wins);
+    sqlite3_bind_int(stmt, 2, losses);
+    sqlite3_bind_int(stmt, 3, elo);
+    sqlite3_bind_text(stmt, 4, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_step(stmt);
 }
 
-void UserManager::logMatch(const std::string& winner, const std::string& loser, int winnerDelta, int loserDelta, const std::string& replayFile) {
-    std::string sql = "INSERT INTO match_history (winner, loser, winner_elo_change, loser_elo_change, replay_file) VALUES (?, ?, ?, ?, ?);";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+void UserManager::logMatch(DbConnection& conn, const std::string& winner, const std::string& loser, int winnerDelta, int loserDelta, const std::string& replayFile) {
+    ScopedStatement stmt(conn.statements[STMT_LOG_MATCH]);
+    if (stmt) {
         sqlite3_bind_text(stmt, 1, winner.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_text(stmt, 2, loser.c_str(), -1, SQLITE_STATIC);
         sqlite3_bind_int(stmt, 3, winnerDelta);
         sqlite3_bind_int(stmt, 4, loserDelta);
         sqlite3_bind_text(stmt, 5, replayFile.c_str(), -1, SQLITE_STATIC);
         sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
     }
 }
 
+void UserManager::registerUser(const std::string& username, const std::string& password, Completion onCommitted) {
+    // apply and onCommitted both run on the writer thread, one after the other
+    auto created = std::make_shared<bool>(false);
+    writeAsync([this, username, password, created](DbConnection& conn) {
+        if (findUser(conn, username)) return; // Already exists
+        *created = insertUser(conn, username, password);
+        if (*created) uncommittedUsers.push_back(User{username, password, 0, 0, 1000});
+    }, [created, onCommitted](bool committed) { onCommitted(committed && *created); });
+}
+
+bool UserManager::loginUser(const std::string& username, const std::string& password) {
+    // Loads the record into the cache for the session that follows
+    auto user = getUser(username);
+    return user && user->password == password;
+}
+
+std::optional<User> UserManager::getUser(const std::string& username) {
+    if (auto cached = cache.get(username)) return cached;
+
+    // Taken before the read, so a commit landing during it keeps this row out
+    uint64_t seenWrites = cache.writeCount();
+    std::optional<User> user;
+    {
+        std::lock_guard<std::mutex> lock(readMutex);
+        user = findUser(reader, username);
+    }
+    if (user) cache.insert(*user, seenWrites);
+    return user;
+}
+
+std::pair<int, int> UserManager::recordMatch(const std::string& winnerName, const std::string& loserName, const std::string& replayFile) {
+    int winnerDelta = 0, loserDelta = 0;
+
+    // Applied inside the writer's open batch, so ratings always build on the
+    // previous match even before it is committed. The writer reads its own
+    // connection rather than the cache, which only holds committed rows.
+    bool applied = write([&](DbConnection& conn) {
+        auto winnerOpt = findUser(conn, winnerName);
+        auto loserOpt = findUser(conn, loserName);
+
+        // Create dummy users if not found (e.g. AI)
+        User winner = winnerOpt.value_or(User{winnerName, "", 0, 0, 1000});
+        User loser = loserOpt.value_or(User{loserName, "", 0, 0, 1000});
+
+        // Elo Config
+        double Ra = (double)winner.elo;
+        double Rb = (double)loser.elo;
+        double Ea = 1.0 / (1.0 + pow(10.0, (Rb - Ra) / 400.0));
+        double Eb = 1.0 / (1.0 + pow(10.0, (Ra - Rb) / 400.0));
+        int K = 32;
+        winnerDelta = (int)(K * (1.0 - Ea));
+        loserDelta = (int)(K * (0.0 - Eb));
+
+        winner.elo += winnerDelta;
+        loser.elo += loserDelta;
+        winner.wins++;
+        loser.losses++;
+
+        // Update whichever players exist
+        if (winnerOpt) {
+            updateStats(conn, winner.username, winner.wins, winner.losses, winner.elo);
+            uncommittedUsers.push_back(winner);
+        }
+        if (loserOpt) {
+            updateStats(conn, loser.username, loser.wins, loser.losses, loser.elo);
+            uncommittedUsers.push_back(loser);
+        }
+
+        logMatch(conn, winnerName, loserName, winnerDelta, loserDelta, replayFile);
+    }, false);
+
+    if (!applied) {
+        std::cerr << "Match not recorded: " << winnerName << " vs " << loserName << std::endl;
+        return {0, 0};
+    }
+    std::cout << "Match Recorded (DB): " << winnerName << " (+" << winnerDelta << ") vs " << loserName << " (" << loserDelta << ")" << std::endl;
+    
+    return {winnerDelta, loserDelta};
+}
+
 std::vector<HistoryEntry> UserManager::getHistory(const std::string& username) {
+    std::lock_guard<std::mutex> lock(readMutex);
     std::vector<HistoryEntry> history;
     // Query where user is winner OR loser
-    std::string sql = "SELECT timestamp, winner, loser, winner_elo_change, loser_elo_change, replay_file FROM match_history WHERE winner = ? OR loser = ? ORDER BY id DESC LIMIT 20;";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return history;
+    ScopedStatement stmt(reader.statements[STMT_HISTORY]);
+    if (!stmt) return history;
     
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_STATIC);
@@ -271,14 +438,13 @@ std::vector<HistoryEntry> UserManager::getHistory(const std::string& username) {
         }
         history.push_back(entry);
     }
-    sqlite3_finalize(stmt);
     return history;
 }
 
 std::string UserManager::getLeaderboard() {
-    std::string sql = "SELECT username, elo, wins, losses FROM users ORDER BY elo DESC LIMIT 10;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return "Error getting leaderboard";
+    std::lock_guard<std::mutex> lock(readMutex);
+    ScopedStatement stmt(reader.statements[STMT_LEADERBOARD]);
+    if (!stmt) return "Error getting leaderboard";
 
     std::stringstream ss;
     ss << "TOP 10 PLAYERS\n----------------\n";
@@ -292,86 +458,89 @@ std::string UserManager::getLeaderboard() {
         ss << rank << ". " << (u ? u : "Unknown") << " - Elo: " << elo << " (W:" << wins << " L:" << losses << ")\n";
         rank++;
     }
-    sqlite3_finalize(stmt);
     return ss.str();
 }
 
-bool UserManager::addFriendRequest(const std::string& user, const std::string& friendName) {
-    // 1. Check if user exists
-    if (!getUser(friendName)) return false; 
-    if (user == friendName) return false;
+void UserManager::addFriendRequest(const std::string& user, const std::string& friendName, Completion onCommitted) {
+    if (user == friendName) {
+        onCommitted(false);
+        return;
+    }
 
-    // 2. Check overlap
-    // If (user, friend) exists -> fail (already requested)
-    // If (friend, user) exists AND pending -> Auto Accept? Or fail and say "They already invited you"
-    
-    // Simplest: Check if ANY relationship exists
-    std::string checkSql = "SELECT status FROM friends WHERE (requester=? AND target=?) OR (requester=? AND target=?);";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, checkSql.c_str(), -1, &stmt, 0) != SQLITE_OK) return false;
-    
-    sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, friendName.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, friendName.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, user.c_str(), -1, SQLITE_STATIC);
-    
-    bool exists = (sqlite3_step(stmt) == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    
-    if (exists) return false; // Already related
+    auto added = std::make_shared<bool>(false);
+    writeAsync([user, friendName, added](DbConnection& conn) {
+        // 1. Check if user exists
+        if (!findUser(conn, friendName)) return;
 
-    // 3. Insert PENDING
-    std::string sql = "INSERT INTO friends (requester, target, status) VALUES (?, ?, 'PENDING');";
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return false;
-    
-    sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, friendName.c_str(), -1, SQLITE_STATIC);
-    
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    return (rc == SQLITE_DONE);
+        // 2. Check overlap
+        // If (user, friend) exists -> fail (already requested)
+        // If (friend, user) exists AND pending -> Auto Accept? Or fail and say "They already invited you"
+        
+        // Simplest: Check if ANY relationship exists
+        {
+            ScopedStatement check(conn.statements[STMT_FRIEND_CHECK]);
+            if (!check) return;
+
+            sqlite3_bind_text(check, 1, user.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(check, 2, friendName.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(check, 3, friendName.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(check, 4, user.c_str(), -1, SQLITE_STATIC);
+
+            if (sqlite3_step(check) == SQLITE_ROW) return; // Already related
+        }
+
+        // 3. Insert PENDING
+        ScopedStatement stmt(conn.statements[STMT_FRIEND_INSERT]);
+        if (!stmt) return;
+        
+        sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, friendName.c_str(), -1, SQLITE_STATIC);
+        
+        *added = (sqlite3_step(stmt) == SQLITE_DONE);
+    }, [added, onCommitted](bool committed) { onCommitted(committed && *added); });
 }
 
-bool UserManager::acceptFriendRequest(const std::string& user, const std::string& friendName) {
-    // User is accepting a request FROM friendName
-    std::string sql = "UPDATE friends SET status='ACCEPTED' WHERE requester=? AND target=? AND status='PENDING';";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return false;
-    
-    sqlite3_bind_text(stmt, 1, friendName.c_str(), -1, SQLITE_STATIC); // Friend is requester
-    sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);       // User is target
-    
-    int rc = sqlite3_step(stmt);
-    int changed = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
-    
-    return (rc == SQLITE_DONE && changed > 0);
+void UserManager::acceptFriendRequest(const std::string& user, const std::string& friendName, Completion onCommitted) {
+    writeAsync([user, friendName](DbConnection& conn) {
+        // User is accepting a request FROM friendName
+        ScopedStatement stmt(conn.statements[STMT_FRIEND_ACCEPT]);
+        if (!stmt) return;
+        
+        sqlite3_bind_text(stmt, 1, friendName.c_str(), -1, SQLITE_STATIC); // Friend is requester
+        sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);       // User is target
+        
+        sqlite3_step(stmt);
+    }, onCommitted);
 }
 
-bool UserManager::removeFriend(const std::string& user, const std::string& friendName) {
-    std::string sql = "DELETE FROM friends WHERE (requester=? AND target=?) OR (requester=? AND target=?);";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return false;
-    
-    sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, friendName.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, friendName.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, user.c_str(), -1, SQLITE_STATIC);
-    
-    int rc = sqlite3_step(stmt);
-    int changed = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
-    
-    return (rc == SQLITE_DONE && changed > 0);
+void UserManager::removeFriend(const std::string& user, const std::string& friendName, Completion onCommitted) {
+    writeAsync([user, friendName](DbConnection& conn) {
+        ScopedStatement stmt(conn.statements[STMT_FRIEND_REMOVE]);
+        if (!stmt) return;
+        
+        sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, friendName.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, friendName.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, user.c_str(), -1, SQLITE_STATIC);
+        
+        sqlite3_step(stmt);
+    }, onCommitted);
+}
+
+void UserManager::getFriendList(const std::string& user, std::function<void(std::string)> onReady) {
+    // Read on the writer connection, in queue order, so the list already reflects
+    // every friend change this user made before asking; handed over once applied
+    auto list = std::make_shared<std::string>();
+    enqueue(WriteJob{[user, list](DbConnection& conn) { *list = readFriendList(conn, user); },
+                     [list, onReady](bool) { onReady(std::move(*list)); }, false});
 }
 
-std::string UserManager::getFriendList(const std::string& user) {
+std::string UserManager::readFriendList(DbConnection& conn, const std::string& user) {
     std::string list;
     
     // Find all relationships
-    std::string sql = "SELECT requester, target, status FROM friends WHERE requester=? OR target=?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) return "";
+    ScopedStatement stmt(conn.statements[STMT_FRIEND_LIST]);
+    if (!stmt) return "";
     
     sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);
@@ -399,7 +568,6 @@ std::string UserManager::getFriendList(const std::string& user) {
         if (!list.empty()) list += ",";
         list += other + ":" + statusStr;
     }
-    sqlite3_finalize(stmt);
     return list;
 }
 
@@ -3,26 +3,64 @@
 #include <sqlite3.h>
 #include <optional>
 #include <vector>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include "../common/Protocol.h"
+#include "UserCache.h"
 
 namespace Buckshot {
 
-struct User {
-    std::string username;
-    std::string password;
-    int wins = 0;
-    int losses = 0;
-    int elo = 1000;
+// How hard a commit pushes to disk (PRAGMA synchronous on the writer connection)
+enum Durability {
+    DURABILITY_OFF,    // Never fsync: an OS crash or power loss can lose recent commits
+    DURABILITY_NORMAL, // WAL default: fsync at checkpoints; power loss can roll back the last commits
+    DURABILITY_FULL    // fsync every group commit
 };
 
+struct DatabaseOptions {
+    std::string path = "buckshot.db";
+    Durability durability = DURABILITY_NORMAL;
+    int commitWindowMs = 5; // How long an open group commit waits for more writes
+    int maxBatch = 64;      // Writes per group commit
+    size_t userCacheSize = 4096; // Offline users kept in memory (online users always are)
+};
+
+// Storage model:
+// The database runs in WAL mode with two connections. All writes go to a single
+// writer thread that owns the write connection; it applies queued writes inside an
+// open transaction and commits them as a group once the batch is full, the commit
+// window has passed, or a caller is waiting on the commit. Reads use their own
+// connection and never wait behind a commit.
+//
+// Match results only wait until they are applied (the Elo deltas come from inside
+// the batch), so a burst of game ends shares one commit. Registration and friend
+// changes never block the caller: they are queued, and their completions run on
+// the writer thread once the change is committed (or with false if the commit
+// failed and the batch was rolled back). Friend lists are read by the writer too,
+// behind any friend change queued before them.
+//
+// User records are served from a write-through UserCache: lookups only reach the
+// reader connection on a miss, and the writer thread puts every users row it
+// changes back into the cache once the batch holding it is committed.
 class UserManager {
 public:
-    UserManager();
-    ~UserManager();
+    explicit UserManager(const DatabaseOptions& options = DatabaseOptions());
+    ~UserManager(); // Commits whatever is queued before returning
+
+    // Completions run on the writer thread and must not block. They get false
+    // when the change was refused or its batch failed to commit.
+    using Completion = std::function<void(bool)>;
 
-    bool registerUser(const std::string& username, const std::string& password);
+    void registerUser(const std::string& username, const std::string& password, Completion onCommitted);
     bool loginUser(const std::string& username, const std::string& password);
     std::optional<User> getUser(const std::string& username);
+    // Online users stay cached until they log off
+    void setOnline(const std::string& username, bool online) { cache.setOnline(username, online); }
     
     // Returns pair<int, int> -> (winnerDelta, loserDelta)
     std::pair<int, int> recordMatch(const std::string& winner, const std::string& loser, const std::string& replayFile = "");
@@ -30,19 +68,84 @@ public:
     std::string getLeaderboard();
 
     // Friends
-    bool addFriendRequest(const std::string& user, const std::string& friendName);
-    bool acceptFriendRequest(const std::string& user, const std::string& friendName);
-    bool removeFriend(const std::string& user, const std::string& friendName);
-    std::string getFriendList(const std::string& user); // Returns serialized list "friend1:STATUS,friend2:STATUS"
+    void addFriendRequest(const std::string& user, const std::string& friendName, Completion onCommitted); // true if a request was created
+    void acceptFriendRequest(const std::string& user, const std::string& friendName, Completion onCommitted);
+    void removeFriend(const std::string& user, const std::string& friendName, Completion onCommitted);
+    // Serialized list "friend1:STATUS,friend2:STATUS", handed to onReady on the writer thread
+    void getFriendList(const std::string& user, std::function<void(std::string)> onReady);
 
     // Migration
     void migrateFromFlatFile(const std::string& filepath);
 
+    // Cached prepared statements, one per query (SQL in UserManager.cpp)
+    enum StatementId {
+        STMT_BEGIN,
+        STMT_COMMIT,
+        STMT_ROLLBACK,
+        STMT_INSERT_USER,
+        STMT_GET_USER,
+        STMT_UPDATE_STATS,
+        STMT_LOG_MATCH,
+        STMT_HISTORY,
+        STMT_LEADERBOARD,
+        STMT_FRIEND_CHECK,
+        STMT_FRIEND_INSERT,
+        STMT_FRIEND_ACCEPT,
+        STMT_FRIEND_REMOVE,
+        STMT_FRIEND_LIST,
+        STMT_COUNT
+    };
+
 private:
-    sqlite3* db = nullptr;
-    
+    // One SQLite connection and its statement cache (prepared once, reset and
+    // rebound per call, finalized on close)
+    struct DbConnection {
+        sqlite3* db = nullptr;
+        std::array<sqlite3_stmt*, STMT_COUNT> statements{};
+    };
+
+    DatabaseOptions options;
+    UserCache cache;
+
+    DbConnection reader;   // Any thread, one at a time
+    std::mutex readMutex;
+    DbConnection writer;   // Writer thread only (and the constructor, before it starts)
+
+    // Writes waiting for the writer thread
+    struct WriteJob {
+        std::function<void(DbConnection&)> apply;
+        // Runs once applied (with true), or with the commit's outcome if waitForCommit.
+        // Gets false without apply having run if the batch could not be opened.
+        std::function<void(bool)> done;
+        bool waitForCommit = false;
+    };
+    std::mutex writeMutex;
+    std::condition_variable writeReady;
+    std::deque<WriteJob> writeQueue;
+    bool stopping = false;
+    std::thread writerThread;
+    // Users rows changed in the open batch (writer thread only). They reach the
+    // cache after the commit, or are evicted from it if the commit fails.
+    std::vector<User> uncommittedUsers;
+
     void initDatabase();
-    void logMatch(const std::string& winner, const std::string& loser, int winnerElo, int loserElo, const std::string& replayFile);
+    bool openConnection(DbConnection& conn);
+    void closeConnection(DbConnection& conn);
+    void runWriter();
+    void enqueue(WriteJob job);
+    // Runs apply on the writer thread and blocks until it has run (or been committed).
+    // False if it never ran, or waitForCommit and the commit failed.
+    bool write(std::function<void(DbConnection&)> apply, bool waitForCommit);
+    // Queues apply without waiting; onCommitted (if any) runs on the writer thread
+    // once it is committed. Without one the write is free to wait for a full batch.
+    void writeAsync(std::function<void(DbConnection&)> apply, std::function<void(bool)> onCommitted);
+    static bool step(DbConnection& conn, StatementId id); // Runs a parameterless statement
+
+    static std::optional<User> findUser(DbConnection& conn, const std::string& username);
+    static bool insertUser(DbConnection& conn, const std::string& username, const std::string& password);
+    static void updateStats(DbConnection& conn, const std::string& username, int wins, int losses, int elo);
+    static std::string readFriendList(DbConnection& conn, const std::string& user);
+    static void logMatch(DbConnection& conn, const std::string& winner, const std::string& loser, int winnerElo, int loserElo, const std::string& replayFile);
 };
 
 }
@@ -0,0 +1,84 @@
+#include "WorkerPool.h"
+#include <cstdint>
+
+namespace Buckshot {
+
+// Index of the pool worker running on this thread (SIZE_MAX elsewhere)
+static thread_local const WorkerPool* currentPool = nullptr;
+static thread_local size_t currentWorker = SIZE_MAX;
+
+WorkerPool::WorkerPool(int threadCount, Poster post) : post(std::move(post)) {
+    if (threadCount < 1) threadCount = 1;
+    for (int i = 0; i < threadCount; ++i) workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread = std::thread([this, i]() { run(i); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+void WorkerPool::submit(Task task, Task onComplete) {
+    size_t target = currentPool == this ? currentWorker : nextWorker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->jobs.push_back(Job{std::move(task), std::move(onComplete)});
+        queued++;
+    }
+    // A worker that just saw queued == 0 is either still holding sleepMutex or
+    // already waiting, so this notify cannot fall between its check and its wait
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_one();
+}
+
+bool WorkerPool::take(size_t self, Job& job) {
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker& victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::run(size_t self) {
+    currentPool = this;
+    currentWorker = self;
+
+    while (true) {
+        Job job;
+        if (take(self, job)) {
+            job.task();
+            if (job.onComplete && post) post(std::move(job.onComplete));
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Buckshot {
+
+// CPU worker pool for jobs that should not run on a reactor.
+// Every worker has its own deque. Submissions are spread round-robin (a job submitted
+// from a worker goes to that worker's own deque); a worker takes its newest job first
+// and, once its deque is empty, steals the oldest job from another worker.
+//
+// A job may carry an onComplete callback. It does not run on the worker: it is handed
+// to the pool's poster (SocketServer::post for the server), which is the way results
+// get back to reactor-owned state.
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    // Takes a finished job's onComplete to wherever it should run; called on the worker
+    using Poster = std::function<void(Task)>;
+
+    WorkerPool(int threadCount, Poster post);
+    ~WorkerPool(); // Runs every queued job first
+
+    void submit(Task task, Task onComplete = nullptr);
+
+    int getThreadCount() const { return (int)workers.size(); }
+
+private:
+    struct Job {
+        Task task;
+        Task onComplete;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker{0};
+    Poster post;
+
+    // Idle workers sleep here until something is queued
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    // Jobs sitting in the deques. Only changed under the deque lock of the push or
+    // pop it counts, so it never runs ahead of or behind the jobs themselves.
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+
+    void run(size_t self);
+    bool take(size_t self, Job& job); // Own deque first, then steal
+};
+
+}
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <signal.h>
+#include <thread>
 #include "Server.h"
 
 int main(int argc, char** argv) {
@@ -7,10 +8,31 @@ int main(int argc, char** argv) {
     if (argc > 1) {
         port = std::stoi(argv[1]);
     }
+    // Optional: number of reactor threads ("0" = one per core)
+    int reactors = 1;
+    if (argc > 2) {
+        reactors = std::stoi(argv[2]);
+        if (reactors <= 0) reactors = (int)std::thread::hardware_concurrency();
+        if (reactors <= 0) reactors = 1;
+    }
+    // Optional: number of CPU worker threads ("0" = one per core)
+    int workers = 2;
+    if (argc > 3) {
+        workers = std::stoi(argv[3]);
+        if (workers <= 0) workers = (int)std::thread::hardware_concurrency();
+        if (workers <= 0) workers = 1;
+    }
+    // Optional: database durability, "off" / "normal" (default) / "full"
+    Buckshot::DatabaseOptions db;
+    if (argc > 4) {
+        std::string mode = argv[4];
+        if (mode == "off") db.durability = Buckshot::DURABILITY_OFF;
+        else if (mode == "full") db.durability = Buckshot::DURABILITY_FULL;
+    }
     
     std::cout << "Starting Buckshot Server on port " << port << "..." << std::endl;
     signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE to prevent crash on client disconnect
-    Buckshot::Server server(port);
+    Buckshot::Server server(port, reactors, workers, db);
     server.run();
     return 0;
 }